@@ -1,4 +1,5 @@
 #include "profiler.h"
+#include "profiler_mpi.h"
 
 #include <iostream>
 #include <mpi.h>
@@ -19,11 +20,17 @@ int main (int argc, char *argv[])
     os.open(fname);
 
     auto profiler = Profiler(os);
+    // align the timeline of every rank to the clock of rank 0
+    profiler.enable_timeline();
+    ::Profiler::sync_clocks(profiler, MPI_COMM_WORLD);
 
     profiler.start("hello");
     profiler.stop("hello");
     profiler.start("world");
     profiler.stop("world");
+    ::Profiler::sync_clocks(profiler, MPI_COMM_WORLD);
+    std::ofstream trace("profiler_trace_myid_" + std::to_string(myid) + ".json");
+    profiler.write_chrome_trace(trace, myid);
     // display() will save the profiling to per-process output
     profiler.display();
 
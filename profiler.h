@@ -1,11 +1,37 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
 #include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <ctime>
+#include <fstream>
+#include <functional>
+#include <map>
 #include <memory>
+#include <new>
 #include <ostream>
 #include <string>
 #include <sstream>
+#include <stdexcept>
+#include <type_traits>
 #include <iomanip>
+#include <limits>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+  #include <x86intrin.h>
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
 #ifdef PROFILER_MEMORY_PROF
 #if defined(_WIN32)
   #define NOMINMAX
@@ -19,6 +45,7 @@
 #elif defined(_SC_AVPHYS_PAGES) || defined(_SC_PAGESIZE)
   #include <unistd.h>
 #endif
+#include <thread>
 #endif
 
 namespace Profiler {
@@ -41,11 +68,10 @@ static inline double cpu_time_from_clocks_diff(const std::clock_t& ct_start,
 //     return ss.str();
 // }
 
-static std::string get_timestamp()
+static std::string format_timestamp(const std::chrono::time_point<std::chrono::system_clock> &now)
 {
     using namespace std::chrono;
 
-    const auto now = system_clock::now();
     const auto ms  = duration_cast<milliseconds>(now.time_since_epoch()) % 1000;
     const std::time_t t = system_clock::to_time_t(now);
 
@@ -66,6 +92,135 @@ static std::string get_timestamp()
     return std::string(buf);
 }
 
+static std::string get_timestamp()
+{
+    return format_timestamp(std::chrono::system_clock::now());
+}
+
+//! Fields of /proc/self/smaps_rollup kept in MemoryMap
+static constexpr const char *memory_map_fields[] = {"Rss", "Anonymous", "AnonHugePages", "Shared_Clean",
+                                                    "Shared_Dirty", "Private_Clean", "Private_Dirty", "Swap"};
+static constexpr size_t memory_map_nfields = sizeof(memory_map_fields) / sizeof(memory_map_fields[0]);
+
+//! Memory mapping totals of the process in kB, in the order of memory_map_fields
+struct MemoryMap
+{
+    int64_t kb[memory_map_nfields] = {};
+};
+
+//! smaps_rollup sampled around the calls of a timer, or at intervals while it runs
+struct MemoryMapSample
+{
+    //! sampled at each start and stop, otherwise only by Profiler::sample_memory_map
+    bool at_calls = false;
+    MemoryMap start;
+    //! sum of the changes over the samples
+    MemoryMap delta;
+    uint64_t nsamples = 0;
+};
+
+//! CPU throttling of the cgroup (cpu.stat), stall totals (cpu.pressure, memory.pressure) of the cgroup,
+//! or of the system without cgroup v2, and steal time of all CPUs (/proc/stat), in the order of pressure_fields
+static constexpr const char *pressure_fields[] = {"nr_throttled", "throttled_usec", "cpu some", "memory some",
+                                                  "memory full", "steal"};
+static constexpr size_t pressure_nfields = sizeof(pressure_fields) / sizeof(pressure_fields[0]);
+
+//! Contention counters, all in us except nr_throttled
+struct Pressure
+{
+    int64_t v[pressure_nfields] = {};
+};
+
+//! Pressure sampled around the calls of a timer
+struct PressureSample
+{
+    Pressure start;
+    //! sum of the changes, and wall time of the sampled calls (ms)
+    Pressure delta;
+    double wall_ms = 0.0;
+    uint64_t nsamples = 0;
+};
+
+namespace detail
+{
+#if defined(__linux__)
+// Read a small proc or cgroup file from offset 0, empty on error
+inline std::string pread_all(const int fd)
+{
+    char buf[1024];
+    const auto n = fd >= 0 ? pread(fd, buf, sizeof(buf) - 1, 0) : -1;
+    return n > 0 ? std::string(buf, n) : std::string();
+}
+
+// Value after "total=" on the line of a PSI file starting with kind ("some" or "full")
+inline int64_t psi_total(const std::string &s, const char *kind)
+{
+    const auto line = s.find(kind);
+    if (line == std::string::npos) return 0;
+    const auto total = s.find("total=", line);
+    return total == std::string::npos ? 0 : std::strtoll(s.c_str() + total + 6, nullptr, 10);
+}
+
+//! Files read by read_pressure, opened once
+struct PressureFiles
+{
+    int cpu_stat = -1;
+    int cpu_pressure = -1;
+    int memory_pressure = -1;
+    int proc_stat = -1;
+    double us_per_tick = 1e4;
+
+    PressureFiles()
+    {
+        // cgroup v2 of the process, "0::/path" in /proc/self/cgroup
+        std::string dir;
+        std::ifstream cgroup("/proc/self/cgroup");
+        for (std::string line; std::getline(cgroup, line);)
+            if (line.compare(0, 3, "0::") == 0) dir = "/sys/fs/cgroup" + line.substr(3);
+        const auto open_first = [](const std::string &a, const std::string &b) {
+            const int fd = a.empty() ? -1 : open(a.c_str(), O_RDONLY | O_CLOEXEC);
+            return fd >= 0 ? fd : open(b.c_str(), O_RDONLY | O_CLOEXEC);
+        };
+        if (!dir.empty()) cpu_stat = open((dir + "/cpu.stat").c_str(), O_RDONLY | O_CLOEXEC);
+        cpu_pressure = open_first(dir.empty() ? "" : dir + "/cpu.pressure", "/proc/pressure/cpu");
+        memory_pressure = open_first(dir.empty() ? "" : dir + "/memory.pressure", "/proc/pressure/memory");
+        proc_stat = open("/proc/stat", O_RDONLY | O_CLOEXEC);
+        const long ticks = sysconf(_SC_CLK_TCK);
+        if (ticks > 0) us_per_tick = 1e6 / double(ticks);
+    }
+};
+#endif
+}
+
+// Read the pressure counters. Counters without their file, e.g. outside a cgroup with a CPU quota, stay 0.
+static int read_pressure(Pressure &p)
+{
+#if defined(__linux__)
+    static const detail::PressureFiles files;
+    p = Pressure();
+    const auto cpu_stat = detail::pread_all(files.cpu_stat);
+    for (size_t i = 0; i < 2; i++)
+    {
+        const auto pos = cpu_stat.find(pressure_fields[i]);
+        if (pos != std::string::npos)
+            p.v[i] = std::strtoll(cpu_stat.c_str() + pos + std::strlen(pressure_fields[i]), nullptr, 10);
+    }
+    p.v[2] = detail::psi_total(detail::pread_all(files.cpu_pressure), "some");
+    const auto memory = detail::pread_all(files.memory_pressure);
+    p.v[3] = detail::psi_total(memory, "some");
+    p.v[4] = detail::psi_total(memory, "full");
+    // "cpu  user nice system idle iowait irq softirq steal ..."
+    const auto stat = detail::pread_all(files.proc_stat);
+    long long steal = 0;
+    if (std::sscanf(stat.c_str(), "cpu %*d %*d %*d %*d %*d %*d %*d %lld", &steal) == 1)
+        p.v[5] = int64_t(double(steal) * files.us_per_tick);
+    return 0;
+#else
+    (void)p;
+    return 1;
+#endif
+}
+
 #ifdef PROFILER_MEMORY_PROF
 // Get node memory in GB
 static int get_node_free_mem(double &free_mem)
@@ -180,6 +335,117 @@ static int get_node_free_mem(double &free_mem)
     free_mem = static_cast<double>(bytes) * 1.e-9;
     return retcode;
 }
+
+// Get the resident set size of the process in bytes
+static int get_process_rss(double &rss_bytes)
+{
+    rss_bytes = 0.0;
+#if defined(__linux__)
+    // Kept open, so that each sample is a single read
+    static const int fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+    char buf[128];
+    const auto n = fd >= 0 ? pread(fd, buf, sizeof(buf) - 1, 0) : -1;
+    if (n <= 0) return 1;
+    buf[n] = '\0';
+    unsigned long long size_pages = 0, resident_pages = 0;
+    if (std::sscanf(buf, "%llu %llu", &size_pages, &resident_pages) != 2) return 1;
+    rss_bytes = double(resident_pages) * double(sysconf(_SC_PAGESIZE));
+    return 0;
+#elif defined(__APPLE__)
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, reinterpret_cast<task_info_t>(&info), &count) != KERN_SUCCESS)
+        return 1;
+    rss_bytes = double(info.resident_size);
+    return 0;
+#else
+    return 1;
+#endif
+}
+
+// Read /proc/self/smaps_rollup (Linux 4.14 or later)
+static int read_memory_map(MemoryMap &map)
+{
+#if defined(__linux__)
+    // Kept open, so that each sample is a single read. The kernel still walks all the mappings.
+    static const int fd = open("/proc/self/smaps_rollup", O_RDONLY | O_CLOEXEC);
+    char buf[4096];
+    const auto n = fd >= 0 ? pread(fd, buf, sizeof(buf) - 1, 0) : -1;
+    if (n <= 0) return 1;
+    buf[n] = '\0';
+    map = MemoryMap();
+    for (const char *line = buf; line && *line; line = std::strchr(line, '\n'), line = line ? line + 1 : line)
+    {
+        for (size_t i = 0; i < memory_map_nfields; i++)
+        {
+            const auto len = std::strlen(memory_map_fields[i]);
+            if (std::strncmp(line, memory_map_fields[i], len) == 0 && line[len] == ':')
+                map.kb[i] = std::strtoll(line + len + 1, nullptr, 10);
+        }
+    }
+    return 0;
+#else
+    (void)map;
+    return 1;
+#endif
+}
+
+namespace detail
+{
+//! Background sampling of the process RSS, shared by all profilers. Each new peak, higher than the
+//! previous one by min_growth, increments generation so that the profilers snapshot their open timers.
+struct PeakMonitor
+{
+    std::atomic<uint64_t> generation{0};
+    //! RSS of the last peak, and highest RSS sampled, bytes
+    std::atomic<uint64_t> peak_bytes{0};
+    //! system clock time of the sample of the last peak, ns since the epoch
+    std::atomic<int64_t> peak_ns{0};
+    std::atomic<uint64_t> max_bytes{0};
+    std::atomic<bool> running{false};
+    std::atomic<bool> stopping{false};
+    std::thread thread;
+
+    void start(const double period, const double min_growth)
+    {
+        bool expected = false;
+        if (!running.compare_exchange_strong(expected, true)) return;
+        thread = std::thread([this, period, min_growth]() {
+            while (!stopping.load(std::memory_order_relaxed))
+            {
+                double rss = 0.0;
+                if (get_process_rss(rss) == 0)
+                {
+                    const auto bytes = uint64_t(rss);
+                    if (bytes > max_bytes.load(std::memory_order_relaxed)) max_bytes.store(bytes);
+                    if (rss > double(peak_bytes.load(std::memory_order_relaxed)) * (1.0 + min_growth))
+                    {
+                        peak_bytes.store(bytes);
+                        peak_ns.store(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                          std::chrono::system_clock::now().time_since_epoch())
+                                          .count());
+                        generation.fetch_add(1, std::memory_order_release);
+                    }
+                }
+                std::this_thread::sleep_for(std::chrono::duration<double>(period));
+            }
+        });
+    }
+
+    ~PeakMonitor()
+    {
+        stopping = true;
+        if (thread.joinable()) thread.join();
+    }
+};
+
+// Not static: all translation units share the monitor
+inline PeakMonitor &peak_monitor()
+{
+    static PeakMonitor monitor;
+    return monitor;
+}
+}
 #endif
 
 static std::string banner(char c, int n)
@@ -189,265 +455,2969 @@ static std::string banner(char c, int n)
     return s;
 }
 
-//! A simple profiler object to record timing of code snippet runs in the program.
-class Profiler
+namespace detail
 {
-private:
-    //! Class to track timing of a particular part of code
-    class Timer
-    {
-    public:
-        //! the number of timer calls
-        size_t ncalls;
-        //! clock when the timer is started
-        std::clock_t clock_start;
-        //! wall time when the timer is started
-        std::chrono::time_point<std::chrono::system_clock> wt_start;
-        //! accumulated cpu time
-        double cpu_time_accu;
-        //! accumulated wall time, i.e. elapsed time
-        double wall_time_accu;
-        //! cpu time during last call
-        double cpu_time_last;
-        //! wall time during last call
-        double wall_time_last;
-        //! Timer name
-        std::string name;
-        //! Side note for the timer, not used as timer identification
-        std::string note;
+//! Timer that is currently running on the calling thread, read by the optional extensions.
+//! An aggregate, all null when value-initialized with {}.
+struct ThreadActivity
+{
+    const void *owner;
+    const std::string *timer;
+    //! running timer of owner, and the function building its path from the top-level timer
+    const void *node;
+    std::string (*path)(const void *node);
+};
 
-        std::shared_ptr<Timer> parent;
-        std::shared_ptr<Timer> prev;
-        std::shared_ptr<Timer> next;
-        // First child
-        std::shared_ptr<Timer> child;
+// Not static: every translation unit must see the same thread-local slot
+inline ThreadActivity &this_thread_activity() noexcept
+{
+    thread_local ThreadActivity activity;
+    return activity;
+}
+}
 
-        Timer(const std::string &tname, const std::string &tnote)
-            : ncalls(0), clock_start(0), wt_start(), cpu_time_accu(0),
-              wall_time_accu(0), cpu_time_last(0), wall_time_last(0),
-              name(tname), note(tnote), parent(nullptr), prev(nullptr),
-              next(nullptr), child(nullptr) {}
+//! Name of the timer currently running on the calling thread, nullptr if none
+inline const std::string *active_timer_name() noexcept
+{
+    return detail::this_thread_activity().timer;
+}
 
-        //! start the timer
-        void start() noexcept
-        {
-            if(is_on())
-                stop();
-            ncalls++;
-            clock_start = clock();
-            wt_start = std::chrono::system_clock::now();
-            cpu_time_last = 0.0;
-            wall_time_last = 0.0;
-            // librpa_int::global::lib_printf("start: %zu %zu %f\n", ncalls, clock_start, wt_start);
-        }
+//! Path of the timer currently running on the calling thread, e.g. "step/solve", empty if none
+inline std::string active_timer_path()
+{
+    const auto &activity = detail::this_thread_activity();
+    return activity.path ? activity.path(activity.node) : std::string();
+}
 
-        //! stop the timer and record the timing
-        void stop() noexcept
-        {
-            if(!is_on()) return;
-            cpu_time_accu += (cpu_time_last = cpu_time_from_clocks_diff(clock_start, clock()));
-            const auto wt_end = std::chrono::system_clock::now();
-            const auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(wt_end - wt_start);
-            wall_time_accu += (wall_time_last = duration.count() * 1e-6);
-            // reset
-            wt_start = {};
-            clock_start = 0;
-        }
+//! Small integer identifying the calling thread in trace exports, 0 for the first thread using it
+inline unsigned this_thread_index() noexcept
+{
+    static std::atomic<unsigned> nthreads{0};
+    thread_local unsigned index = nthreads.fetch_add(1);
+    return index;
+}
 
-        bool is_on() const { return clock_start != 0; };
-    };
+static inline int64_t system_clock_ns() noexcept
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
 
-    std::ostream *p_os;
-    std::shared_ptr<Timer> root;
-    std::shared_ptr<Timer> current;
+static inline std::string json_escape(const std::string &s)
+{
+    std::string out;
+    for (const char c: s)
+    {
+        if (c == '"' || c == '\\') { out += '\\'; out += c; }
+        else if (static_cast<unsigned char>(c) < 0x20) out += ' ';
+        else out += c;
+    }
+    return out;
+}
+
+//! Element of a timer path: the timer name, and the integer key of keyed timers
+struct PathEntry
+{
+    std::string name;
+    bool keyed = false;
+    int64_t key = 0;
 
-    // Find child timer with timer name
-    std::shared_ptr<Timer> search_timer_in_hierarchy(std::shared_ptr<Timer> timer, const std::string& tname)
+    bool operator==(const PathEntry &other) const
     {
-        if (!timer) return nullptr;
-        if (timer->name == tname) return timer;
+        return name == other.name && keyed == other.keyed && key == other.key;
+    }
+};
 
-        // Recursively check child timers
-        if (timer->child)
-        {
-            auto found_timer = search_timer_in_hierarchy(timer->child, tname);
-            if (found_timer)
-            {
-                return found_timer;
-            }
-        }
+//! Handle of a running timer, used to attach work on other threads to it
+struct SpanContext
+{
+    //! Timers from the top level down to the spawning timer
+    std::vector<PathEntry> path;
+    //! When and on which thread the span was captured, the start of the flow arrows
+    int64_t ts_ns = 0;
+    unsigned tid = 0;
+};
 
-        // Check the next sibling timer
-        if (timer->next)
-        {
-            return search_timer_in_hierarchy(timer->next, tname);
-        }
+//! Offset of the local system clock to a reference clock, e.g. of rank 0, measured at local time local_ns
+struct ClockSample
+{
+    int64_t local_ns = 0;
+    //! local minus reference time
+    double offset_ns = 0.0;
+    //! round-trip time of the measurement, an upper bound of twice its error
+    double rtt_ns = 0.0;
+};
 
-        return nullptr;
-    }
+//! Linear map from the local system clock to the reference clock: the offset at t0_ns plus a drift rate
+struct ClockCorrection
+{
+    int64_t t0_ns = 0;
+    double offset_ns = 0.0;
+    double drift = 0.0;
 
-    std::shared_ptr<Timer> find_timer_in_hierarchy(const std::string &tname)
+    int64_t apply(const int64_t local_ns) const noexcept
     {
-        return search_timer_in_hierarchy(current, tname);
+        return local_ns - int64_t(std::llround(offset_ns + drift * double(local_ns - t0_ns)));
     }
+};
+
+//! Fixed-size uniform sample of (problem size, wall time in seconds) pairs of timer calls
+class SizeReservoir
+{
+public:
+    std::vector<std::pair<double, double>> samples;
+    //! number of pairs offered so far
+    uint64_t nseen;
 
-    std::string get_profile_string_of_timer(std::shared_ptr<Timer> timer, const int level, const int verbose)
+    explicit SizeReservoir(size_t capacity) : nseen(0), capacity(capacity), rng(0x9E3779B97F4A7C15ULL)
     {
-        std::ostringstream ss;
-        // std::string indent(2 * level, ' ');
-        std::string indent_s(this->indent * level, ' ');
-        const auto note = indent_s + (timer->note == "" ? timer->name : timer->note);
-        std::ostringstream cstr_cputime, cstr_walltime;
-        cstr_cputime << std::fixed << std::setprecision(4) << timer->cpu_time_accu;
-        cstr_walltime << std::fixed << std::setprecision(4) << timer->wall_time_accu;
+        samples.reserve(capacity);
+    }
 
-        // Print self
-        ss << std::left;
-        ss << std::setw(49) << note << " " << std::setw(12) << timer->ncalls << " "
-            << std::setw(18) << (indent_s + cstr_cputime.str()) << " "
-            << std::setw(18) << (indent_s + cstr_walltime.str()) << "\n";
-        // Print child, then sibling
-        if (timer->child && verbose > level)
-            ss << get_profile_string_of_timer(timer->child, level + 1, verbose);
-        if (timer->next && verbose >= level)
-            ss << get_profile_string_of_timer(timer->next, level, verbose);
-        return ss.str();
+    void offer(double size, double time) noexcept
+    {
+        nseen++;
+        if (samples.size() < capacity)
+        {
+            samples.emplace_back(size, time);
+            return;
+        }
+        // Algorithm R: keep the new pair with probability capacity / nseen
+        rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+        const auto i = rng % nseen;
+        if (i < capacity) samples[i] = {size, time};
     }
 
-public:
-    //! Indent for printing final statistics
-    unsigned int indent;
+private:
+    size_t capacity;
+    uint64_t rng;
+};
 
-    Profiler() : p_os(nullptr), root(nullptr), current(nullptr), indent(1) {};
-    Profiler(std::ostream &os_in)
-        : p_os(&os_in), root(nullptr), current(nullptr), indent(1) {};
+//! Least-squares fit of time against problem size
+struct ComplexityFit
+{
+    //! best of the models t = coef * f(N), with f one of 1, N, NlogN, N^2, N^3
+    std::string model;
+    double coef = 0.0;
+    //! root mean square error relative to the mean time
+    double rms = 0.0;
+    //! power law t = prefactor * N^exponent, fitted in log-log space
+    double prefactor = 0.0;
+    double exponent = 0.0;
+    bool valid = false;
 
-    //! Add a timer
-    void add(const std::string &tname, const std::string &tnote = "") noexcept
+    static double basis(const std::string &model, const double n)
     {
-        auto new_timer = std::make_shared<Timer>(tname, tnote);
+        if (model == "N") return n;
+        if (model == "NlogN") return n * std::log2(n);
+        if (model == "N^2") return n * n;
+        if (model == "N^3") return n * n * n;
+        return 1.0;
+    }
 
-        if (!root)
-        {
-            root = new_timer;
-        }
-        else
-        {
-            if (current)
-            {
-                if (current->child)
-                {
-                    auto sibling = current->child;
-                    while (sibling->next) sibling = sibling->next;
-                    sibling->next = new_timer;
-                    new_timer->prev = sibling;
-                }
-                else
-                {
-                    current->child = new_timer;
-                }
-                new_timer->parent = current;
-            }
-        }
+    double predict(const double n) const { return coef * basis(model, n); }
+};
 
-        current = new_timer;
+//! Fit the complexity models to the (size, time) samples. Invalid if fewer than two distinct positive sizes.
+static inline ComplexityFit fit_complexity(const std::vector<std::pair<double, double>> &samples)
+{
+    ComplexityFit fit;
+    double nmin = 0.0, nmax = 0.0, tmean = 0.0;
+    size_t n = 0;
+    for (const auto &st: samples)
+    {
+        if (st.first <= 0.0 || st.second <= 0.0) continue;
+        nmin = n ? std::min(nmin, st.first) : st.first;
+        nmax = n ? std::max(nmax, st.first) : st.first;
+        tmean += st.second;
+        n++;
     }
+    if (n < 2 || nmin == nmax) return fit;
+    tmean /= n;
 
-    //! Start a timer. If the timer is not added before, add it.
-    void start(const std::string &tname, const std::string &tnote = "") noexcept
+    for (const char *model: {"1", "N", "NlogN", "N^2", "N^3"})
     {
-        // if (omp_get_thread_num() != 0) return;
-        auto timer = find_timer_in_hierarchy(tname);
-        // create a new timer if it is not found, otherwise we move to that timer and start
-        if (!timer)
-        {
-            add(tname, tnote);
-        }
-        else
+        double ft = 0.0, ff = 0.0;
+        for (const auto &st: samples)
         {
-            current = timer;
+            if (st.first <= 0.0 || st.second <= 0.0) continue;
+            const auto f = ComplexityFit::basis(model, st.first);
+            ft += f * st.second;
+            ff += f * f;
         }
-        if (p_os) *p_os << get_timestamp() <<" Timer start: " << tname;
-#ifdef PROFILER_MEMORY_PROF
-        double free_mem_gb;
-        get_node_free_mem(free_mem_gb);
-        if (p_os) *p_os << ". Free memory on node [GB]: " << free_mem_gb;
-#endif
-        if (p_os) *p_os << std::endl;
-        current->start();
-    }
-
-    //! Stop a timer and record the timing
-    void stop(const std::string &tname) noexcept
-    {
-        // if (omp_get_thread_num() != 0) return;
-        if (current)
+        if (ff <= 0.0) continue;
+        const auto coef = ft / ff;
+        double err = 0.0;
+        for (const auto &st: samples)
         {
-            // Check if the current timer matches the given timer name
-            if (current->name == tname)
-            {
-                current->stop();
-                current = current->parent;
-                if (p_os) *p_os << get_timestamp() <<" Timer stop:  " << tname;
-#ifdef PROFILER_MEMORY_PROF
-                double free_mem_gb;
-                get_node_free_mem(free_mem_gb);
-                if (p_os) *p_os << ". Free memory on node [GB]: " << free_mem_gb;
-#endif
-                if (p_os) *p_os << std::endl;
-            }
-            else
-            {
-                if (p_os)
-                    *p_os << "Warning: Attempting to stop timer '" << tname
-                          << "' but current active timer is '" << current->name << "'" << std::endl;
-            }
+            if (st.first <= 0.0 || st.second <= 0.0) continue;
+            const auto d = st.second - coef * ComplexityFit::basis(model, st.first);
+            err += d * d;
         }
-        else
+        const auto rms = std::sqrt(err / n) / tmean;
+        if (!fit.valid || rms < fit.rms)
         {
-            if (p_os) *p_os << "Warning: No timer is currently active" << std::endl;
+            fit.model = model;
+            fit.coef = coef;
+            fit.rms = rms;
+            fit.valid = true;
         }
     }
 
-    //! Get cpu time of last call of timer
-    double get_cpu_time_last(const std::string &tname) noexcept
+    double sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+    for (const auto &st: samples)
     {
-        auto timer = this->find_timer_in_hierarchy(tname);
-        if (timer)
-            return timer->cpu_time_last;
-        return -1.0;
+        if (st.first <= 0.0 || st.second <= 0.0) continue;
+        const auto x = std::log(st.first), y = std::log(st.second);
+        sx += x; sy += y; sxx += x * x; sxy += x * y;
     }
+    fit.exponent = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+    fit.prefactor = std::exp((sy - fit.exponent * sx) / n);
+    return fit;
+}
 
-    //! Get wall time of last call of timer
-    double get_wall_time_last(const std::string &tname) noexcept
-    {
-        auto timer = this->find_timer_in_hierarchy(tname);
-        if (timer)
-            return timer->wall_time_last;
-        return 0.0;
-    }
+//! One timer of a saved profile
+struct ProfileEntry
+{
+    //! 0 for top-level timers. Entries are in pre-order, so the parent is the last entry with depth - 1.
+    int depth = 0;
+    //! Timer names from the top level joined by '/', with keys as name[key]
+    std::string path;
+    std::string note;
+    size_t ncalls = 0;
+    //! in seconds
+    double cpu_time = 0.0;
+    double wall_time = 0.0;
+};
 
-    std::string get_profile_string(const int verbose = 99) noexcept
-    {
-        std::ostringstream output;
-        output << std::left;
+//! Profile written by Profiler::save
+struct SavedProfile
+{
+    std::map<std::string, std::string> metadata;
+    std::vector<ProfileEntry> entries;
+};
 
-        output << banner('-', 100) << "\n";
-        output << std::setw(49) << "Entry" << " " << std::setw(12) << "#calls" << " "
-            << std::setw(18) << "CPU time (s)" << " " << std::setw(18) << "Wall time (s)" << "\n";
-        output << banner('-', 100) << "\n";
-        output << get_profile_string_of_timer(root, 0, verbose);
-        output << banner('-', 100) << "\n";
+static const char *const saved_profile_header = "# SimpleProfiler profile 1";
 
-        return output.str();
+static inline std::string sanitize_field(std::string s)
+{
+    for (auto &c: s)
+        if (c == '\t' || c == '\n' || c == '\r') c = ' ';
+    return s;
+}
+
+//! Read a profile written by Profiler::save. Returns false if the stream is not a saved profile, or if a
+//! line is malformed, whose number is then stored in error_line if given.
+static inline bool load_profile(std::istream &is, SavedProfile &profile, size_t *error_line = nullptr)
+{
+    std::string line;
+    size_t nline = 1;
+    if (error_line) *error_line = nline;
+    if (!std::getline(is, line) || line != saved_profile_header) return false;
+    while (std::getline(is, line))
+    {
+        nline++;
+        if (line.empty()) continue;
+        if (line[0] == '#')
+        {
+            // "# key<TAB>value"
+            const auto tab = line.find('\t');
+            if (tab != std::string::npos && tab > 2)
+                profile.metadata[line.substr(2, tab - 2)] = line.substr(tab + 1);
+            continue;
+        }
+        std::istringstream ss(line);
+        ProfileEntry e;
+        std::string field;
+        try
+        {
+            std::getline(ss, field, '\t'); e.depth = std::stoi(field);
+            std::getline(ss, e.path, '\t');
+            std::getline(ss, field, '\t'); e.ncalls = std::stoull(field);
+            std::getline(ss, field, '\t'); e.cpu_time = std::stod(field);
+            std::getline(ss, field, '\t'); e.wall_time = std::stod(field);
+        }
+        catch (const std::exception &)
+        {
+            if (error_line) *error_line = nline;
+            return false;
+        }
+        std::getline(ss, e.note);
+        profile.entries.push_back(e);
+    }
+    return true;
+}
+
+//! Event of the binary trace written by Profiler::write_trace.
+//! The file holds the magic, uint32 version, int32 pid, uint32 nnames, the names as uint32 length
+//! and characters, uint64 nevents and the events.
+struct TraceRecord
+{
+    //! start in ns since epoch of the system clock, and duration in ns
+    int64_t ts_ns;
+    int64_t dur_ns;
+    //! index in the name table, keyed timers have their own name[key] entry
+    uint32_t name;
+    uint32_t tid;
+};
+
+static const char trace_magic[8] = {'S', 'P', 'T', 'R', 'A', 'C', 'E', '1'};
+
+//! Header of the file written by BasicProfiler::enable_persistent and read by tools/read_mapped.cpp.
+//! It is followed by page-aligned segments, each holding chunk_nodes hot lines then chunk_nodes
+//! MappedNode records, so that the file grows and is mapped one segment at a time.
+struct MappedHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t segment_size;
+    uint32_t chunk_nodes;
+    uint32_t line_size;
+    uint32_t node_size;
+    //! byte offsets of the fields in a hot line, -1 if the policy has no such field
+    int32_t off_start, off_ncalls, off_accu, off_seq, off_cpu_accu;
+    int32_t pid;
+    //! ns per clock tick, and ns from the epoch of the clock to the epoch of the system clock
+    double ns_per_tick;
+    int64_t clock_offset_ns;
+    //! system clock ns at the creation of the file
+    int64_t created_ns;
+    //! number of segments in the file, set once a segment is initialized
+    std::atomic<uint32_t> nsegments;
+    //! set to 1 when the profiler is destroyed, still 0 if the process was killed
+    std::atomic<uint32_t> closed;
+};
+
+//! Timer tree node of a mapped profile, with the same ID as its hot line
+struct MappedNode
+{
+    //! set to 1 once the other fields are written
+    std::atomic<uint32_t> published;
+    //! ID + 1 of the parent, 0 at the top level
+    uint32_t parent;
+    uint32_t keyed;
+    //! length of the full name, which is truncated to fit in name
+    uint32_t name_length;
+    int64_t key;
+    char name[104];
+};
+static_assert(sizeof(MappedNode) == 128, "mapped node records are 128 bytes");
+
+static const char mapped_magic[8] = {'S', 'P', 'M', 'A', 'P', 'P', 'D', '1'};
+
+//! Raw time stamp counter, or steady clock nanoseconds where there is no counter readable from user space
+static inline uint64_t read_tsc() noexcept
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t v;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(v));
+    return v;
+#else
+    return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+//! ns per tick of read_tsc, calibrated once per process against the steady clock where it is not known
+static inline double tsc_ns_per_tick()
+{
+    static const double ns_per_tick = [] {
+#if defined(__x86_64__) || defined(__i386__)
+        using steady = std::chrono::steady_clock;
+        const auto t0 = steady::now();
+        const auto tsc0 = read_tsc();
+        auto t1 = t0;
+        while (t1 - t0 < std::chrono::milliseconds(2)) t1 = steady::now();
+        const auto tsc1 = read_tsc();
+        return std::chrono::duration<double, std::nano>(t1 - t0).count() / double(tsc1 - tsc0);
+#elif defined(__aarch64__)
+        uint64_t freq;
+        asm volatile("mrs %0, cntfrq_el0" : "=r"(freq));
+        return 1e9 / double(freq);
+#else
+        return 1.0;
+#endif
+    }();
+    return ns_per_tick;
+}
+
+//! Fixed-size ring of the last timer transitions of one profiler
+class FlightRecorder
+{
+public:
+    struct Event
+    {
+        uint64_t tsc;
+        int64_t key;
+        uint32_t name_id;
+        //! 'B' for start, 'E' for stop
+        char phase;
+        bool keyed;
+    };
+
+    //! capacity is rounded up to a power of two
+    //! The first recorder of the process calibrates the counter, for about 2 ms on x86
+    explicit FlightRecorder(size_t capacity) : head(0), ns_per_tick(tsc_ns_per_tick())
+    {
+        size_t n = 1;
+        while (n < capacity) n <<= 1;
+        ring.resize(n);
+    }
+
+    void record(const uint32_t name_id, const char phase, const bool keyed, const int64_t key) noexcept
+    {
+        auto &e = ring[head++ & (ring.size() - 1)];
+        e.tsc = read_tsc();
+        e.key = key;
+        e.name_id = name_id;
+        e.phase = phase;
+        e.keyed = keyed;
+    }
+
+    //! Write the events in the ring, oldest first, in Chrome trace event format
+    void dump(std::ostream &os, const std::vector<std::string> &names, const int pid, const unsigned tid,
+              const std::string &reason, const ClockCorrection &correction) const
+    {
+        // Convert the counter to system clock backwards from now, at the calibrated rate
+        const auto tsc1 = read_tsc();
+        const auto ns1 = system_clock_ns();
+        const auto flags = os.flags();
+        os << std::fixed << std::setprecision(3);
+        os << "{\"traceEvents\":[\n";
+        os << "{\"name\":\"" << json_escape(reason) << "\",\"ph\":\"i\",\"s\":\"g\",\"ts\":" << correction.apply(ns1) * 1e-3
+           << ",\"pid\":" << pid << ",\"tid\":" << tid << "}";
+        const uint64_t n = std::min<uint64_t>(head, ring.size());
+        for (uint64_t i = head - n; i < head; i++)
+        {
+            const auto &e = ring[i & (ring.size() - 1)];
+            const auto ts_ns = correction.apply(ns1 - int64_t(double(tsc1 - e.tsc) * ns_per_tick));
+            std::string name = e.name_id < names.size() ? names[e.name_id] : std::string("?");
+            if (e.keyed) name += "[" + std::to_string(e.key) + "]";
+            os << ",\n{\"name\":\"" << json_escape(name) << "\",\"ph\":\"" << e.phase << "\",\"ts\":" << ts_ns * 1e-3
+               << ",\"pid\":" << pid << ",\"tid\":" << tid << "}";
+        }
+        os << "\n]}\n";
+        os.flags(flags);
+    }
+
+private:
+    std::vector<Event> ring;
+    uint64_t head;
+    double ns_per_tick;
+};
+
+//! One of the slowest calls of a timer
+struct SlowCall
+{
+    //! start of the call, ns since epoch of the system clock
+    int64_t ts_ns;
+    //! wall time of the call in seconds
+    double duration;
+    unsigned tid;
+    int rank;
+    //! problem size set by Profiler::tag_size, negative if not set
+    double size;
+};
+
+//! Sustainable memory bandwidth and peak floating-point rates of the machine, see profiler_roofline.h
+struct MachineBalance
+{
+    int nthreads = 1;
+    //! STREAM triad bandwidth with all threads, GB/s
+    double bandwidth = 0.0;
+    //! peak scalar and SIMD double-precision rates with all threads, GFLOP/s
+    double scalar_gflops = 0.0;
+    double simd_gflops = 0.0;
+
+    //! Attainable GFLOP/s at arithmetic intensity ai (flop/byte)
+    double attainable(const double ai) const { return std::min(simd_gflops, ai * bandwidth); }
+};
+
+//! Features of a BasicProfiler, fixed at compile time. Disabled features take no space in the timers.
+//! Derive from it to change some of them, e.g. struct WallOnly : DefaultPolicy { static constexpr bool cpu_time = false; };
+struct DefaultPolicy
+{
+    //! clock of the wall times
+    using clock = std::chrono::system_clock;
+    //! CPU time of each call, with std::clock
+    static constexpr bool cpu_time = true;
+    //! free node memory in the verbose log, also needs PROFILER_MEMORY_PROF for the platform headers
+#ifdef PROFILER_MEMORY_PROF
+    static constexpr bool memory = true;
+#else
+    static constexpr bool memory = false;
+#endif
+    //! flop and byte counters of add_flops and add_bytes
+    static constexpr bool counters = true;
+    //! per-call distributions: problem size samples of tag_size and the slowest calls
+    static constexpr bool histograms = true;
+    //! fastest and slowest call and call time histogram of each timer, for the call time percentiles of
+    //! AccumulatorTable::reduce. Written at each stop outside the hot line of the timer, so off by default.
+    static constexpr bool call_times = false;
+};
+
+//! Wall time and number of calls only, on the steady clock
+struct LeanPolicy
+{
+    using clock = std::chrono::steady_clock;
+    static constexpr bool cpu_time = false;
+    static constexpr bool memory = false;
+    static constexpr bool counters = false;
+    static constexpr bool histograms = false;
+    static constexpr bool call_times = false;
+};
+
+namespace detail
+{
+// Offset from the epoch of Clock to the epoch of the system clock in ns
+template <typename Clock>
+int64_t clock_offset_ns() noexcept
+{
+    if (std::is_same<Clock, std::chrono::system_clock>::value) return 0;
+    return system_clock_ns() -
+           std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+// Objects in 64-byte aligned chunks, indexed by a dense ID. Addresses are stable.
+template <typename T>
+class LineArena
+{
+public:
+    static constexpr size_t chunk_size = 256;
+
+    LineArena() : n(0) {}
+    LineArena(const LineArena &) = delete;
+    LineArena &operator=(const LineArena &) = delete;
+
+    //! The chunks are moved, so the addresses of the objects stay valid
+    LineArena(LineArena &&other) noexcept
+        : n(other.n), storage(std::move(other.storage)), chunks(std::move(other.chunks)),
+          chunk_source(std::move(other.chunk_source))
+    {
+        other.n = 0;
+        other.chunks.clear();
+    }
+
+    LineArena &operator=(LineArena &&other) noexcept
+    {
+        if (this == &other) return *this;
+        destroy();
+        n = other.n;
+        storage = std::move(other.storage);
+        chunks = std::move(other.chunks);
+        chunk_source = std::move(other.chunk_source);
+        other.n = 0;
+        other.chunks.clear();
+        return *this;
+    }
+
+    ~LineArena() { destroy(); }
+
+    //! Take the chunks from source(chunk index), e.g. a file mapping, or from the heap where it returns null
+    void set_chunk_source(std::function<void *(size_t)> source) { chunk_source = std::move(source); }
+
+    uint32_t allocate()
+    {
+        if (n % chunk_size == 0)
+        {
+            void *mapped = chunk_source ? chunk_source(chunks.size()) : nullptr;
+            if (mapped)
+                chunks.push_back(static_cast<T *>(mapped));
+            else
+            {
+                storage.emplace_back(new char[chunk_size * sizeof(T) + 64]);
+                const auto p = reinterpret_cast<uintptr_t>(storage.back().get());
+                chunks.push_back(reinterpret_cast<T *>((p + 63) & ~uintptr_t(63)));
+            }
+        }
+        new (&(*this)[n]) T();
+        return uint32_t(n++);
+    }
+
+    T &operator[](const size_t id) noexcept { return chunks[id / chunk_size][id % chunk_size]; }
+    const T &operator[](const size_t id) const noexcept { return chunks[id / chunk_size][id % chunk_size]; }
+    size_t size() const noexcept { return n; }
+
+private:
+    size_t n;
+    std::vector<std::unique_ptr<char[]>> storage;
+    std::vector<T *> chunks;
+    std::function<void *(size_t)> chunk_source;
+
+    void destroy() noexcept
+    {
+        for (size_t i = 0; i < n; i++) (*this)[i].~T();
+        n = 0;
+    }
+};
+
+#if defined(__unix__) || defined(__APPLE__)
+// Shared mapping of a profile file laid out as described by MappedHeader. Dirty pages of a shared
+// mapping belong to the page cache, so the profile outlives the process however it ends.
+class MappedProfile
+{
+public:
+    MappedProfile(const MappedProfile &) = delete;
+    MappedProfile &operator=(const MappedProfile &) = delete;
+
+    //! Create or truncate fname with the header layout, null on failure
+    static std::unique_ptr<MappedProfile> create(const std::string &fname, const MappedHeader &layout)
+    {
+        const int fd = ::open(fname.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return nullptr;
+        std::unique_ptr<MappedProfile> m(new MappedProfile(fd, layout));
+        if (!m->reserve(layout.header_size)) return nullptr;
+        void *p = mmap(nullptr, layout.header_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) return nullptr;
+        m->header = static_cast<MappedHeader *>(p);
+        std::memcpy(static_cast<void *>(m->header), static_cast<const void *>(&layout), sizeof(MappedHeader));
+        std::memset(m->header->magic, 0, sizeof(mapped_magic));
+        m->header->nsegments.store(0);
+        m->header->closed.store(0);
+        // The magic goes last, a reader never sees a partial header
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(m->header->magic, mapped_magic, sizeof(mapped_magic));
+        return m;
+    }
+
+    ~MappedProfile()
+    {
+        if (header)
+        {
+            header->closed.store(1, std::memory_order_release);
+            munmap(header, layout.header_size);
+        }
+        for (auto *s: segments)
+            if (s) munmap(s, layout.segment_size);
+        ::close(fd);
+    }
+
+    //! Hot lines of segment k, growing the file to it, null if the file cannot grow
+    void *segment(const size_t k)
+    {
+        if (segments.size() <= k) segments.resize(k + 1, nullptr);
+        const auto offset = off_t(layout.header_size) + off_t(k) * off_t(layout.segment_size);
+        if (!reserve(offset + off_t(layout.segment_size))) return nullptr;
+        void *p = mmap(nullptr, layout.segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+        if (p == MAP_FAILED) return nullptr;
+        segments[k] = static_cast<char *>(p);
+        // Segments are only added in order, a failed one stays as zeros in the file
+        header->nsegments.store(uint32_t(k + 1), std::memory_order_release);
+        return p;
+    }
+
+    //! Record of node id, null if its segment is not in the file
+    MappedNode *node(const size_t id) noexcept
+    {
+        const auto k = id / layout.chunk_nodes;
+        if (k >= segments.size() || !segments[k]) return nullptr;
+        return reinterpret_cast<MappedNode *>(segments[k] + size_t(layout.chunk_nodes) * layout.line_size) +
+               id % layout.chunk_nodes;
+    }
+
+private:
+    int fd;
+    MappedHeader layout;
+    MappedHeader *header = nullptr;
+    std::vector<char *> segments;
+
+    MappedProfile(const int tfd, const MappedHeader &tlayout) : fd(tfd)
+    {
+        std::memcpy(static_cast<void *>(&layout), static_cast<const void *>(&tlayout), sizeof(MappedHeader));
+    }
+
+    // Allocate the blocks up to size, so that a full disk fails here rather than with SIGBUS on a store
+    bool reserve(const off_t size) noexcept
+    {
+#if defined(__linux__)
+        const int rc = posix_fallocate(fd, 0, size);
+        if (rc == 0) return true;
+        if (rc != EINVAL && rc != EOPNOTSUPP) return false;
+#endif
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size >= size) return true;
+        return ftruncate(fd, size) == 0;
+    }
+};
+#endif
+
+// CPU time of a timer, in its hot line
+template <bool enabled>
+struct CpuClock
+{
+    //! clock when the timer is started
+    std::clock_t clock_start = 0;
+    //! accumulated cpu time and cpu time during last call, in seconds
+    double cpu_accu = 0.0;
+    double cpu_last = 0.0;
+
+    void start_cpu() noexcept
+    {
+        clock_start = clock();
+        cpu_last = 0.0;
+    }
+
+    void stop_cpu() noexcept
+    {
+        cpu_accu += (cpu_last = cpu_time_from_clocks_diff(clock_start, clock()));
+        clock_start = 0;
+    }
+
+    void add_cpu(const CpuClock &other) noexcept { cpu_accu += other.cpu_accu; }
+    const double *cpu_accu_field() const noexcept { return &cpu_accu; }
+    double cpu_time_accu() const noexcept { return cpu_accu; }
+    double cpu_time_last() const noexcept { return cpu_last; }
+};
+
+template <>
+struct CpuClock<false>
+{
+    void start_cpu() noexcept {}
+    void stop_cpu() noexcept {}
+    void add_cpu(const CpuClock &) noexcept {}
+    const double *cpu_accu_field() const noexcept { return nullptr; }
+    double cpu_time_accu() const noexcept { return 0.0; }
+    double cpu_time_last() const noexcept { return 0.0; }
+};
+
+// Flop and byte counters of a timer
+template <bool enabled>
+struct TimerCounters
+{
+    double flops_accu = 0.0;
+    double bytes_accu = 0.0;
+
+    void add_flops(const double flops) noexcept { flops_accu += flops; }
+    void add_bytes(const double bytes) noexcept { bytes_accu += bytes; }
+    void add_counters(const TimerCounters &other) noexcept
+    {
+        flops_accu += other.flops_accu;
+        bytes_accu += other.bytes_accu;
+    }
+    double flops() const noexcept { return flops_accu; }
+    double bytes() const noexcept { return bytes_accu; }
+};
+
+template <>
+struct TimerCounters<false>
+{
+    void add_flops(const double) noexcept {}
+    void add_bytes(const double) noexcept {}
+    void add_counters(const TimerCounters &) noexcept {}
+    double flops() const noexcept { return 0.0; }
+    double bytes() const noexcept { return 0.0; }
+};
+
+inline bool slower_call(const SlowCall &a, const SlowCall &b) { return a.duration > b.duration; }
+
+// Per-call distributions of a timer: sampled problem sizes and the slowest calls
+template <bool enabled>
+class TimerHistograms
+{
+public:
+    //! Problem size of the running call, negative if not set
+    double call_size() const noexcept { return size; }
+    void set_call_size(const double s) noexcept { size = s; }
+    //! Sampled problem sizes and times, null until a call is tagged with a size
+    const SizeReservoir *size_samples() const noexcept { return sizes.get(); }
+
+    void offer_size(const double time, const size_t capacity)
+    {
+        if (!sizes) sizes.reset(new SizeReservoir(capacity));
+        sizes->offer(size, time);
+    }
+
+    void add_size_samples(const SizeReservoir &other, const size_t capacity)
+    {
+        if (!sizes) sizes.reset(new SizeReservoir(capacity));
+        for (const auto &st: other.samples) sizes->offer(st.first, st.second);
+    }
+
+    //! Wall time (ms) a call must exceed to enter the slowest calls, negative until the heap is full
+    double slowest_threshold() const noexcept { return threshold; }
+    //! Min-heap of the slowest calls, null before the first one
+    const std::vector<SlowCall> *slowest_calls() const noexcept { return slowest.get(); }
+
+    //! Discard the calls kept so far, keep the k slowest of the next ones
+    void keep_slowest(const size_t k)
+    {
+        slowest.reset();
+        threshold = k > 0 ? -1.0 : HUGE_VAL;
+    }
+
+    // Keep call if it is one of the nslowest slowest calls
+    void offer_slow_call(const SlowCall &call, const size_t nslowest)
+    {
+        if (!slowest) slowest.reset(new std::vector<SlowCall>());
+        auto &heap = *slowest;
+        if (heap.size() < nslowest)
+        {
+            heap.push_back(call);
+            std::push_heap(heap.begin(), heap.end(), slower_call);
+        }
+        else if (!heap.empty() && call.duration > heap.front().duration)
+        {
+            std::pop_heap(heap.begin(), heap.end(), slower_call);
+            heap.back() = call;
+            std::push_heap(heap.begin(), heap.end(), slower_call);
+        }
+        threshold = heap.size() < nslowest ? -1.0 : heap.front().duration * 1e3;
+    }
+
+private:
+    double size = -1.0;
+    std::unique_ptr<SizeReservoir> sizes;
+    double threshold = HUGE_VAL;
+    std::unique_ptr<std::vector<SlowCall>> slowest;
+};
+
+template <>
+class TimerHistograms<false>
+{
+public:
+    double call_size() const noexcept { return -1.0; }
+    void set_call_size(const double) noexcept {}
+    const SizeReservoir *size_samples() const noexcept { return nullptr; }
+    void offer_size(const double, const size_t) {}
+    void add_size_samples(const SizeReservoir &, const size_t) {}
+    double slowest_threshold() const noexcept { return HUGE_VAL; }
+    const std::vector<SlowCall> *slowest_calls() const noexcept { return nullptr; }
+    void keep_slowest(const size_t) {}
+    void offer_slow_call(const SlowCall &, const size_t) {}
+};
+
+//! Number of buckets of the call time histograms, bucket b counts the calls of [2^b, 2^(b+1)) ns
+constexpr int call_time_buckets = 40;
+
+inline int call_time_bucket(const int64_t ns) noexcept
+{
+    if (ns <= 1) return 0;
+#if defined(__GNUC__)
+    const int b = 63 - __builtin_clzll(uint64_t(ns));
+#else
+    int b = 0;
+    for (auto v = uint64_t(ns); v > 1; v >>= 1) b++;
+#endif
+    return std::min(b, call_time_buckets - 1);
+}
+
+// Fastest and slowest call and call time histogram of each timer, indexed by node ID
+template <bool enabled>
+struct CallDistributions
+{
+    std::vector<int64_t> min_ns;
+    std::vector<int64_t> max_ns;
+    //! node-major, call_time_buckets per node
+    std::vector<uint64_t> buckets;
+
+    void grow(const size_t nnodes)
+    {
+        min_ns.resize(nnodes, std::numeric_limits<int64_t>::max());
+        max_ns.resize(nnodes, 0);
+        buckets.resize(nnodes * call_time_buckets, 0);
+    }
+
+    void record(const uint32_t id, const int64_t ns) noexcept
+    {
+        min_ns[id] = std::min(min_ns[id], ns);
+        max_ns[id] = std::max(max_ns[id], ns);
+        buckets[size_t(id) * call_time_buckets + call_time_bucket(ns)]++;
+    }
+
+    void add(const uint32_t id, const CallDistributions &other, const uint32_t other_id) noexcept
+    {
+        min_ns[id] = std::min(min_ns[id], other.min_ns[other_id]);
+        max_ns[id] = std::max(max_ns[id], other.max_ns[other_id]);
+        for (int b = 0; b < call_time_buckets; b++)
+            buckets[size_t(id) * call_time_buckets + b] += other.buckets[size_t(other_id) * call_time_buckets + b];
+    }
+
+    //! fastest and slowest call in seconds, 0 without calls
+    double min_time(const uint32_t id) const noexcept
+    {
+        return min_ns[id] == std::numeric_limits<int64_t>::max() ? 0.0 : min_ns[id] * 1e-9;
+    }
+    double max_time(const uint32_t id) const noexcept { return max_ns[id] * 1e-9; }
+    const uint64_t *histogram(const uint32_t id) const noexcept { return &buckets[size_t(id) * call_time_buckets]; }
+};
+
+template <>
+struct CallDistributions<false>
+{
+    void grow(const size_t) {}
+    void record(const uint32_t, const int64_t) noexcept {}
+    void add(const uint32_t, const CallDistributions &, const uint32_t) noexcept {}
+    double min_time(const uint32_t) const noexcept { return 0.0; }
+    double max_time(const uint32_t) const noexcept { return 0.0; }
+    const uint64_t *histogram(const uint32_t) const noexcept { return nullptr; }
+};
+}
+
+//! Accumulators of all the timers of one profiler by node ID, filled by BasicProfiler::snapshot.
+//! Owned by the caller and reused, so that polling the timings in a run does not allocate.
+//! Units are those of the getters: cpu times in s, wall times in ms.
+struct Snapshot
+{
+    //! node ID of each entry, the index in BasicProfiler::node_paths and the id of its TimerHandle,
+    //! stable for the life of the profiler
+    std::vector<uint32_t> path_id;
+    std::vector<uint64_t> ncalls;
+    //! accumulated cpu time (s) and wall time (ms), and those of the last call
+    std::vector<double> cpu_time;
+    std::vector<double> wall_time;
+    std::vector<double> cpu_last;
+    std::vector<double> wall_last;
+    //! fastest and slowest call in ms, 0 without calls or without the call_times policy
+    std::vector<double> min_time;
+    std::vector<double> max_time;
+
+    size_t size() const noexcept { return ncalls.size(); }
+};
+
+//! Node ID of a timer, for lookups in O(1), see BasicProfiler::handle
+struct TimerHandle
+{
+    uint32_t id = std::numeric_limits<uint32_t>::max();
+
+    bool valid() const noexcept { return id != std::numeric_limits<uint32_t>::max(); }
+};
+
+//! Per-node reduction over the profiles of an AccumulatorTable, times in seconds
+struct TableReduction
+{
+    std::vector<uint64_t> ncalls;
+    std::vector<double> cpu_sum;
+    //! wall time summed over the profiles, and its smallest, mean, largest value and percentiles
+    //! over the profiles with calls of the node
+    std::vector<double> wall_sum;
+    std::vector<double> wall_min;
+    std::vector<double> wall_mean;
+    std::vector<double> wall_max;
+    std::vector<double> wall_p50;
+    std::vector<double> wall_p90;
+    //! fastest and slowest call, and call time percentiles from the merged histograms
+    std::vector<double> call_min;
+    std::vector<double> call_max;
+    std::vector<double> call_p50;
+    std::vector<double> call_p90;
+    std::vector<double> call_p99;
+    //! merged call time histograms, node-major
+    std::vector<uint64_t> histogram;
+};
+
+//! Accumulators of several profiles, e.g. of threads or ranks, in structure-of-arrays form.
+//! All profiles share the node layout: the arrays of a profile are indexed by node ID, the ID of paths[ID].
+//! Merges and reductions are passes over contiguous arrays, which the compiler vectorizes.
+class AccumulatorTable
+{
+public:
+    //! Arrays of one profile, times in seconds. Arrays shorter than the number of nodes are zero at the end.
+    struct Columns
+    {
+        std::vector<uint64_t> ncalls;
+        std::vector<double> cpu_time;
+        std::vector<double> wall_time;
+        //! fastest and slowest call, 0 without histograms
+        std::vector<double> min_time;
+        std::vector<double> max_time;
+    };
+
+    //! path and depth of each node
+    std::vector<std::string> paths;
+    std::vector<int> depths;
+    std::vector<Columns> profiles;
+    //! call counts by call_time_bucket of all profiles, node-major, empty without histograms
+    std::vector<uint64_t> histogram;
+
+    size_t size() const noexcept { return paths.size(); }
+    size_t nprofiles() const noexcept { return profiles.size(); }
+
+    //! ID of the node with path, added if missing
+    uint32_t node(const std::string &path, const int depth)
+    {
+        const auto it = ids.find(path);
+        if (it != ids.end()) return it->second;
+        ids.emplace(path, uint32_t(paths.size()));
+        paths.push_back(path);
+        depths.push_back(depth);
+        return uint32_t(paths.size() - 1);
+    }
+
+    //! Interned ID of a timer name, for child
+    uint32_t label(const std::string &name)
+    {
+        const auto it = label_ids.emplace(name, uint32_t(labels.size()));
+        if (it.second) labels.push_back(name);
+        return it.first->second;
+    }
+
+    //! ID of the child of node parent (no_node at the top level) with interned name and key, added if missing.
+    //! The path of the child is only built the first time it is looked up.
+    uint32_t child(const uint32_t parent, const uint32_t name, const bool keyed, const int64_t key)
+    {
+        const ChildKey k{parent, name, keyed, key};
+        const auto it = children.find(k);
+        if (it != children.end()) return it->second;
+        auto leaf = keyed ? labels[name] + "[" + std::to_string(key) + "]" : labels[name];
+        const auto id = parent == no_node ? node(leaf, 0) : node(paths[parent] + "/" + leaf, depths[parent] + 1);
+        children.emplace(k, id);
+        return id;
+    }
+
+    static constexpr uint32_t no_node = std::numeric_limits<uint32_t>::max();
+
+    //! Add a profile of zeros, return its index
+    size_t add_profile()
+    {
+        profiles.emplace_back();
+        return profiles.size() - 1;
+    }
+
+    //! Add a profile read by load_profile, return its index
+    size_t add_profile(const SavedProfile &saved)
+    {
+        const auto p = add_profile();
+        std::vector<uint32_t> nodes;
+        nodes.reserve(saved.entries.size());
+        for (const auto &e: saved.entries) nodes.push_back(node(e.path, e.depth));
+        auto &c = profiles[p];
+        fit(c);
+        for (size_t k = 0; k < nodes.size(); k++)
+        {
+            c.ncalls[nodes[k]] += saved.entries[k].ncalls;
+            c.cpu_time[nodes[k]] += saved.entries[k].cpu_time;
+            c.wall_time[nodes[k]] += saved.entries[k].wall_time;
+        }
+        return p;
+    }
+
+    //! Extend the arrays of profile c to all nodes
+    void fit(Columns &c) const
+    {
+        c.ncalls.resize(size(), 0);
+        c.cpu_time.resize(size(), 0.0);
+        c.wall_time.resize(size(), 0.0);
+        c.min_time.resize(size(), 0.0);
+        c.max_time.resize(size(), 0.0);
+    }
+
+    //! Sum, extrema and percentiles of every node over the profiles
+    TableReduction reduce() const
+    {
+        const size_t n = size();
+        TableReduction r;
+        r.ncalls.assign(n, 0);
+        r.cpu_sum.assign(n, 0.0);
+        r.wall_sum.assign(n, 0.0);
+        r.wall_min.assign(n, HUGE_VAL);
+        r.wall_max.assign(n, 0.0);
+        r.call_min.assign(n, HUGE_VAL);
+        r.call_max.assign(n, 0.0);
+        std::vector<double> npresent(n, 0.0);
+        for (const auto &c: profiles)
+        {
+            const size_t m = std::min(n, c.ncalls.size());
+            const uint64_t *nc = c.ncalls.data();
+            const double *cpu = c.cpu_time.data(), *wall = c.wall_time.data();
+            const double *tmin = c.min_time.data(), *tmax = c.max_time.data();
+            uint64_t *r_ncalls = r.ncalls.data();
+            double *r_cpu = r.cpu_sum.data(), *r_wall = r.wall_sum.data(), *r_wmin = r.wall_min.data();
+            double *r_wmax = r.wall_max.data(), *r_cmin = r.call_min.data(), *r_cmax = r.call_max.data();
+            double *r_np = npresent.data();
+            for (size_t i = 0; i < m; i++) r_ncalls[i] += nc[i];
+            for (size_t i = 0; i < m; i++) r_cpu[i] += cpu[i];
+            for (size_t i = 0; i < m; i++) r_wall[i] += wall[i];
+            // Profiles without calls of a node do not count for its extrema
+            for (size_t i = 0; i < m; i++) r_np[i] += nc[i] != 0 ? 1.0 : 0.0;
+            for (size_t i = 0; i < m; i++) r_wmin[i] = std::min(r_wmin[i], nc[i] != 0 ? wall[i] : HUGE_VAL);
+            for (size_t i = 0; i < m; i++) r_wmax[i] = std::max(r_wmax[i], wall[i]);
+            for (size_t i = 0; i < m; i++) r_cmin[i] = std::min(r_cmin[i], nc[i] != 0 ? tmin[i] : HUGE_VAL);
+            for (size_t i = 0; i < m; i++) r_cmax[i] = std::max(r_cmax[i], tmax[i]);
+        }
+        r.histogram = histogram;
+        r.histogram.resize(histogram.empty() ? 0 : n * detail::call_time_buckets, 0);
+        r.wall_mean.resize(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            r.wall_mean[i] = npresent[i] > 0.0 ? r.wall_sum[i] / npresent[i] : 0.0;
+            if (npresent[i] == 0.0) r.wall_min[i] = 0.0;
+            if (r.call_min[i] == HUGE_VAL) r.call_min[i] = 0.0;
+        }
+
+        // Percentiles over the profiles, on the node-major transpose of the wall times
+        r.wall_p50.assign(n, 0.0);
+        r.wall_p90.assign(n, 0.0);
+        const size_t k = profiles.size();
+        std::vector<double> transposed(n * k, -1.0);
+        for (size_t p = 0; p < k; p++)
+        {
+            const auto &c = profiles[p];
+            for (size_t i = 0; i < std::min(n, c.ncalls.size()); i++)
+                if (c.ncalls[i] > 0) transposed[i * k + p] = c.wall_time[i];
+        }
+        for (size_t i = 0; i < n; i++)
+        {
+            auto first = transposed.begin() + i * k;
+            const auto last = std::remove(first, first + k, -1.0);
+            if (first == last) continue;
+            r.wall_p50[i] = percentile_of(first, last, 0.5);
+            r.wall_p90[i] = percentile_of(first, last, 0.9);
+        }
+
+        // Call time percentiles at the middle of the histogram buckets
+        r.call_p50.assign(n, 0.0);
+        r.call_p90.assign(n, 0.0);
+        r.call_p99.assign(n, 0.0);
+        for (size_t i = 0; i < n && !r.histogram.empty(); i++)
+        {
+            const uint64_t *h = &r.histogram[i * detail::call_time_buckets];
+            uint64_t total = 0;
+            for (int b = 0; b < detail::call_time_buckets; b++) total += h[b];
+            if (total == 0) continue;
+            uint64_t cum = 0;
+            double *targets[3] = {&r.call_p50[i], &r.call_p90[i], &r.call_p99[i]};
+            const double q[3] = {0.5, 0.9, 0.99};
+            int next = 0;
+            for (int b = 0; b < detail::call_time_buckets && next < 3; b++)
+            {
+                cum += h[b];
+                while (next < 3 && cum >= q[next] * total)
+                {
+                    const double t = std::ldexp(1.5, b) * 1e-9;
+                    *targets[next++] = std::min(std::max(t, r.call_min[i]), r.call_max[i]);
+                }
+            }
+        }
+        return r;
+    }
+
+    //! Get the reduction of the profiles as a table, one row per node
+    std::string get_reduction_string(const TableReduction &r) const
+    {
+        std::ostringstream output;
+        output << std::left;
+        output << "Reduction over " << nprofiles() << " profiles, wall time per profile and call time\n";
+        output << banner('-', 120) << "\n";
+        output << std::setw(35) << "Entry" << " " << std::setw(12) << "#calls" << " " << std::setw(10) << "Min (s)"
+               << " " << std::setw(10) << "Mean (s)" << " " << std::setw(10) << "Max (s)" << " " << std::setw(10)
+               << "P90 (s)" << " " << std::setw(8) << "Imbal." << " " << std::setw(10) << "Call P50" << " "
+               << std::setw(10) << "Call P99" << "\n";
+        output << banner('-', 120) << "\n";
+        for (size_t i = 0; i < size(); i++)
+        {
+            const auto slash = paths[i].rfind('/');
+            const auto label = std::string(depths[i], ' ') +
+                               (slash == std::string::npos ? paths[i] : paths[i].substr(slash + 1));
+            std::ostringstream cstr;
+            cstr << std::scientific << std::setprecision(3);
+            auto fmt = [&cstr](const double v) {
+                cstr.str("");
+                cstr << v;
+                return cstr.str();
+            };
+            output << std::setw(35) << label << " " << std::setw(12) << r.ncalls[i] << " " << std::setw(10)
+                   << fmt(r.wall_min[i]) << " " << std::setw(10) << fmt(r.wall_mean[i]) << " " << std::setw(10)
+                   << fmt(r.wall_max[i]) << " " << std::setw(10) << fmt(r.wall_p90[i]) << " ";
+            std::ostringstream cstr_imbalance;
+            cstr_imbalance << std::fixed << std::setprecision(2)
+                           << (r.wall_mean[i] > 0.0 ? r.wall_max[i] / r.wall_mean[i] : 0.0);
+            output << std::setw(8) << cstr_imbalance.str() << " " << std::setw(10) << fmt(r.call_p50[i]) << " "
+                   << std::setw(10) << fmt(r.call_p99[i]) << "\n";
+        }
+        output << banner('-', 120) << "\n";
+        return output.str();
+    }
+
+private:
+    struct ChildKey
+    {
+        uint32_t parent, name;
+        bool keyed;
+        int64_t key;
+
+        bool operator==(const ChildKey &o) const noexcept
+        {
+            return parent == o.parent && name == o.name && keyed == o.keyed && key == o.key;
+        }
+    };
+    struct ChildKeyHash
+    {
+        size_t operator()(const ChildKey &k) const noexcept
+        {
+            uint64_t h = (uint64_t(k.parent) << 32 | k.name) * 0x9E3779B97F4A7C15ULL;
+            return size_t(h ^ (uint64_t(k.key) + (k.keyed ? 0x632BE59BD9B4E019ULL : 0)) * 0xC2B2AE3D27D4EB4FULL);
+        }
+    };
+
+    std::unordered_map<std::string, uint32_t> ids;
+    std::unordered_map<std::string, uint32_t> label_ids;
+    std::vector<std::string> labels;
+    std::unordered_map<ChildKey, uint32_t, ChildKeyHash> children;
+
+    // Percentile q of [first, last) with linear interpolation, reorders the range
+    template <typename It>
+    static double percentile_of(It first, It last, const double q)
+    {
+        const auto n = last - first;
+        const double pos = q * (n - 1);
+        const auto lo = static_cast<decltype(n)>(pos);
+        std::nth_element(first, first + lo, last);
+        const double v_lo = first[lo];
+        if (lo + 1 >= n) return v_lo;
+        const double v_hi = *std::min_element(first + lo + 1, last);
+        return v_lo + (pos - lo) * (v_hi - v_lo);
+    }
+};
+
+//! A simple profiler object to record timing of code snippet runs in the program.
+//! Policy selects the clock and the optional features, see DefaultPolicy.
+template <typename Policy>
+class BasicProfiler
+{
+private:
+    using clock = typename Policy::clock;
+    using rep = typename clock::rep;
+
+    //! Accumulators touched at every start and stop, one cache line per timer
+    struct alignas(64) Hot : detail::CpuClock<Policy::cpu_time>
+    {
+        //! clock ticks when the timer is started, 0 when stopped
+        rep start = 0;
+        //! the number of timer calls
+        uint64_t ncalls = 0;
+        //! accumulated wall clock ticks
+        rep accu = 0;
+        //! wall clock ticks during last call
+        rep last = 0;
+        //! odd while the line is updated, so that a reader of a mapped profile can tell a torn line
+        uint64_t seq = 0;
+
+        // Compiler fences only: the stores of a killed process all reach the page cache, in program order
+        void begin_update() noexcept
+        {
+            seq++;
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+        }
+        void end_update() noexcept
+        {
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+            seq++;
+        }
+    };
+    static_assert(sizeof(Hot) == 64, "the hot accumulators of a timer must fit in one cache line");
+
+    static double ticks_to_ms(const rep ticks) noexcept
+    {
+        return std::chrono::duration<double, std::milli>(typename clock::duration(ticks)).count();
+    }
+
+    static int64_t ticks_to_ns(const rep ticks) noexcept
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(typename clock::duration(ticks)).count();
+    }
+
+    //! Class to track timing of a particular part of code. The accumulators live in the hot line of
+    //! the profiler arena, the rest is only used to find timers and to report.
+    class Timer : public detail::TimerCounters<Policy::counters>, public detail::TimerHistograms<Policy::histograms>
+    {
+    public:
+        //! Hot accumulators, and the dense node ID indexing them in the profiler arena
+        Hot *hot;
+        uint32_t id;
+        //! Timer name
+        std::string name;
+        //! Interned name, used for the lookup
+        uint32_t name_id;
+        //! Side note for the timer, not used as timer identification
+        std::string note;
+        //! Whether this timer is the call of a keyed timer with key, it is then a child of the timer across keys
+        bool keyed;
+        int64_t key;
+        //! Timers of each key, only allocated for timers started with a key
+        std::unique_ptr<std::unordered_map<int64_t, std::shared_ptr<Timer>>> keyed_children;
+        //! wall time (ms) above which the flight recorder is dumped
+        double latency_threshold;
+        //! changes of the memory mappings, only allocated for timers passed to enable_memory_map or sampled
+        std::unique_ptr<MemoryMapSample> memory_map;
+        //! changes of the contention counters, only allocated for timers passed to enable_pressure
+        std::unique_ptr<PressureSample> pressure;
+
+        //! Path of the timer on another thread, if this is a placeholder created by adopt()
+        std::vector<PathEntry> span_path;
+        bool remote;
+
+        std::shared_ptr<Timer> parent;
+        std::shared_ptr<Timer> prev;
+        std::shared_ptr<Timer> next;
+        // First child
+        std::shared_ptr<Timer> child;
+
+        Timer(const std::string &tname, uint32_t tname_id, const std::string &tnote, Hot *thot, uint32_t tid)
+            : hot(thot), id(tid), name(tname), name_id(tname_id), note(tnote), keyed(false), key(0),
+              latency_threshold(HUGE_VAL), remote(false), parent(nullptr), prev(nullptr), next(nullptr), child(nullptr) {}
+
+        //! Name to print in the reports, the note if any, with the key of keyed timers
+        std::string label() const
+        {
+            const auto &s = note == "" ? name : note;
+            return keyed ? s + "[" + std::to_string(key) + "]" : s;
+        }
+
+        //! Name to print in the log and the warnings, as passed to start and stop, with the key of keyed timers
+        std::string log_name() const { return keyed ? name + "[" + std::to_string(key) + "]" : name; }
+
+        //! start the timer
+        void start() noexcept
+        {
+            if(is_on())
+                stop();
+            hot->begin_update();
+            hot->ncalls++;
+            hot->start_cpu();
+            hot->start = clock::now().time_since_epoch().count();
+            hot->last = 0;
+            hot->end_update();
+            this->set_call_size(-1.0);
+        }
+
+        //! stop the timer and record the timing
+        void stop() noexcept
+        {
+            if(!is_on()) return;
+            hot->begin_update();
+            hot->stop_cpu();
+            hot->accu += (hot->last = clock::now().time_since_epoch().count() - hot->start);
+            // reset
+            hot->start = 0;
+            hot->end_update();
+        }
+
+        bool is_on() const { return hot->start != 0; };
+
+        size_t ncalls() const noexcept { return hot->ncalls; }
+        //! accumulated cpu time (s) and wall time (ms)
+        double cpu_time_accu() const noexcept { return hot->cpu_time_accu(); }
+        double wall_time_accu() const noexcept { return ticks_to_ms(hot->accu); }
+        //! cpu time (s) and wall time (ms) during last call
+        double cpu_time_last() const noexcept { return hot->cpu_time_last(); }
+        double wall_time_last() const noexcept { return ticks_to_ms(hot->last); }
+    };
+
+    //! Completed timer call on the timeline
+    struct TraceEvent
+    {
+        const Timer *timer;
+        int64_t ts_ns;
+        int64_t dur_ns;
+        unsigned tid;
+    };
+
+    //! End point of a flow arrow between threads, phase 's' at the spawn and 'f' at the adoption
+    struct FlowEvent
+    {
+        uint64_t id;
+        int64_t ts_ns;
+        unsigned tid;
+        char phase;
+    };
+
+    //! Coalesced verbose log of a timer: transitions logged in full, then calls and ticks at the start of the
+    //! current summary period
+    struct LogWindow
+    {
+        size_t logged = 0;
+        int64_t since_ns = 0;
+        uint64_t ncalls = 0;
+        rep accu = 0;
+    };
+
+    //! Open timers and live heap by timer path at the highest RSS peak. They are taken at the first start
+    //! or stop after the sample of the peak by the monitor thread, at snapshot_ns.
+    struct MemoryPeak
+    {
+        double rss_bytes = 0.0;
+        int64_t ts_ns = 0;
+        int64_t snapshot_ns = 0;
+        std::string path;
+        std::map<std::string, double> heap;
+        size_t npeaks = 0;
+    };
+
+    std::ostream *p_os;
+#if defined(__unix__) || defined(__APPLE__)
+    //! file mapping holding the hot lines and the timer tree, see enable_persistent, outlives hot_lines
+    std::unique_ptr<detail::MappedProfile> mapped;
+#endif
+    //! hot accumulators of the timers by node ID
+    detail::LineArena<Hot> hot_lines;
+    //! fastest and slowest call and call time histogram by node ID
+    detail::CallDistributions<Policy::call_times> distributions;
+    //! ns from the epoch of the clock to the epoch of the system clock
+    int64_t clock_offset_ns;
+    std::shared_ptr<Timer> root;
+    std::shared_ptr<Timer> current;
+    std::unordered_map<std::string, uint32_t> name_ids;
+    //! names by interned ID
+    std::vector<std::string> names;
+    //! latency thresholds (ms) by interned name ID
+    std::unordered_map<uint32_t, double> latency_thresholds;
+    std::unique_ptr<FlightRecorder> recorder;
+    std::string recorder_prefix;
+    size_t ndumps;
+    size_t max_dumps;
+    //! flight recorder files that could not be written
+    size_t nfailed_dumps;
+    std::map<std::string, std::string> metadata;
+    //! rank of the process in reports and traces
+    int rank;
+    //! first clock sample and the correction of the trace timestamps fitted to the samples
+    ClockSample first_clock_sample;
+    size_t nclock_samples;
+    ClockCorrection clock_correction;
+    //! number of slowest calls kept per timer
+    size_t nslowest;
+    bool timeline;
+    std::vector<TraceEvent> events;
+    std::vector<FlowEvent> flows;
+    //! live heap bytes by timer path, e.g. from profiler_heap, taken at the memory peaks
+    std::function<std::map<std::string, double>()> heap_source;
+    //! last peak generation of the RSS monitor seen by this profiler
+    uint64_t seen_peak;
+    MemoryPeak memory_peak;
+    //! interned names of the timers reading smaps_rollup at each call, and the last interval sample
+    std::unordered_set<uint32_t> memory_map_names;
+    std::unique_ptr<MemoryMap> last_memory_map;
+    //! interned names of the timers reading the contention counters at each call
+    std::unordered_set<uint32_t> pressure_names;
+    //! verbose log coalescing, see coalesce_log, and its state by node ID
+    size_t log_full_transitions;
+    double log_period_s;
+    int log_always_depth;
+    std::vector<LogWindow> log_windows;
+
+    uint32_t intern(const std::string &tname)
+    {
+        const auto it = name_ids.emplace(tname, uint32_t(name_ids.size()));
+        if (it.second) names.push_back(tname);
+        return it.first->second;
+    }
+
+    std::shared_ptr<Timer> make_timer(const std::string &tname, const std::string &tnote)
+    {
+        const auto id = hot_lines.allocate();
+        auto timer = std::make_shared<Timer>(tname, intern(tname), tnote, &hot_lines[id], id);
+        distributions.grow(hot_lines.size());
+        if (nslowest > 0) timer->keep_slowest(nslowest);
+        const auto it = latency_thresholds.find(timer->name_id);
+        if (it != latency_thresholds.end()) timer->latency_threshold = it->second;
+        if (memory_map_names.count(timer->name_id))
+        {
+            timer->memory_map.reset(new MemoryMapSample());
+            timer->memory_map->at_calls = true;
+        }
+        if (pressure_names.count(timer->name_id)) timer->pressure.reset(new PressureSample());
+        return timer;
+    }
+
+    // Find child timer with interned timer name. Keyed timers are reached through their timer across keys.
+    std::shared_ptr<Timer> search_timer_in_hierarchy(std::shared_ptr<Timer> timer, const uint32_t tname_id)
+    {
+        if (!timer) return nullptr;
+        if (timer->name_id == tname_id && !timer->keyed) return timer;
+
+        // Recursively check child timers
+        if (timer->child)
+        {
+            auto found_timer = search_timer_in_hierarchy(timer->child, tname_id);
+            if (found_timer)
+            {
+                return found_timer;
+            }
+        }
+
+        // Check the next sibling timer
+        if (timer->next)
+        {
+            return search_timer_in_hierarchy(timer->next, tname_id);
+        }
+
+        return nullptr;
+    }
+
+    std::shared_ptr<Timer> find_timer_in_hierarchy(const std::string &tname)
+    {
+        const auto it = name_ids.find(tname);
+        if (it == name_ids.end()) return nullptr;
+        // Work adopted from another thread only nests under its placeholder
+        if (current && current->remote)
+            return search_timer_in_hierarchy(current->child, it->second);
+        return search_timer_in_hierarchy(current ? current : root, it->second);
+    }
+
+    // Append timer as the last child of parent, or as the last top-level timer if parent is null
+    void link_timer(std::shared_ptr<Timer> timer, std::shared_ptr<Timer> parent)
+    {
+        auto first = parent ? parent->child : root;
+        if (!first)
+        {
+            if (parent) parent->child = timer;
+            else root = timer;
+        }
+        else
+        {
+            while (first->next) first = first->next;
+            first->next = timer;
+            timer->prev = first;
+        }
+        timer->parent = parent;
+        publish_node(*timer);
+    }
+
+    // Write the tree node of timer to the mapped profile, if any
+    void publish_node(const Timer &timer) noexcept
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        auto *node = mapped ? mapped->node(timer.id) : nullptr;
+        if (!node) return;
+        node->parent = timer.parent ? timer.parent->id + 1 : 0;
+        node->keyed = timer.keyed;
+        node->key = timer.key;
+        node->name_length = uint32_t(timer.name.size());
+        const auto n = std::min(timer.name.size(), sizeof(node->name) - 1);
+        std::memcpy(node->name, timer.name.data(), n);
+        node->name[n] = '\0';
+        node->published.store(1, std::memory_order_release);
+#else
+        (void)timer;
+#endif
+    }
+
+    // Find the direct child of parent (top level if null) with name, optionally creating it
+    std::shared_ptr<Timer> child_timer(std::shared_ptr<Timer> parent, const std::string &tname,
+                                       const std::string &tnote, bool create)
+    {
+        for (auto t = parent ? parent->child : root; t; t = t->next)
+            if (t->name == tname && !t->remote) return t;
+        if (!create) return nullptr;
+        auto timer = make_timer(tname, tnote);
+        link_timer(timer, parent);
+        return timer;
+    }
+
+    // Find the timer of key under the timer across keys, optionally creating it
+    std::shared_ptr<Timer> keyed_timer(const std::shared_ptr<Timer> &base, const int64_t key,
+                                       const std::string &tnote, bool create)
+    {
+        if (!base->keyed_children)
+        {
+            if (!create) return nullptr;
+            base->keyed_children.reset(new std::unordered_map<int64_t, std::shared_ptr<Timer>>());
+        }
+        if (!create)
+        {
+            const auto it = base->keyed_children->find(key);
+            return it == base->keyed_children->end() ? nullptr : it->second;
+        }
+        auto &timer = (*base->keyed_children)[key];
+        if (!timer)
+        {
+            timer = make_timer(base->name, tnote);
+            timer->keyed = true;
+            timer->key = key;
+            timer->parent = base;
+            publish_node(*timer);
+        }
+        return timer;
+    }
+
+    // Find the timer with path from the top level, creating the missing ones
+    std::shared_ptr<Timer> resolve_path(const std::vector<PathEntry> &path)
+    {
+        std::shared_ptr<Timer> timer = nullptr;
+        for (const auto &e: path)
+        {
+            if (e.keyed)
+            {
+                if (!timer) break;
+                timer = keyed_timer(timer, e.key, "", true);
+            }
+            else
+                timer = child_timer(timer, e.name, "", true);
+        }
+        return timer;
+    }
+
+    void add_timings(Timer &target, const Timer &src, const BasicProfiler &other)
+    {
+        distributions.add(target.id, other.distributions, src.id);
+        target.hot->begin_update();
+        target.hot->ncalls += src.hot->ncalls;
+        target.hot->accu += src.hot->accu;
+        target.hot->add_cpu(*src.hot);
+        target.hot->end_update();
+        target.add_counters(src);
+        if (src.slowest_calls() && nslowest > 0)
+        {
+            for (const auto &call: *src.slowest_calls()) target.offer_slow_call(call, nslowest);
+        }
+        if (src.size_samples()) target.add_size_samples(*src.size_samples(), size_samples);
+        if (src.memory_map)
+        {
+            if (!target.memory_map) target.memory_map.reset(new MemoryMapSample());
+            for (size_t i = 0; i < memory_map_nfields; i++) target.memory_map->delta.kb[i] += src.memory_map->delta.kb[i];
+            target.memory_map->nsamples += src.memory_map->nsamples;
+        }
+        if (src.pressure)
+        {
+            if (!target.pressure) target.pressure.reset(new PressureSample());
+            for (size_t i = 0; i < pressure_nfields; i++) target.pressure->delta.v[i] += src.pressure->delta.v[i];
+            target.pressure->wall_ms += src.pressure->wall_ms;
+            target.pressure->nsamples += src.pressure->nsamples;
+        }
+    }
+
+    // Add the accumulated timings of src and its subtree to the child of parent with the same name
+    void merge_timer(const std::shared_ptr<Timer> &src, std::shared_ptr<Timer> parent, const BasicProfiler &other,
+                     std::map<const Timer *, const Timer *> &mapping)
+    {
+        for (auto s = src; s; s = s->next)
+        {
+            std::shared_ptr<Timer> target;
+            if (s->remote)
+            {
+                // Graft the adopted work under the spawning timer
+                target = resolve_path(s->span_path);
+            }
+            else
+            {
+                target = child_timer(parent, s->name, s->note, true);
+                add_timings(*target, *s, other);
+            }
+            mapping[s.get()] = target.get();
+            if (s->child) merge_timer(s->child, target, other, mapping);
+            if (!s->keyed_children || !target) continue;
+            for (const auto &kv: *s->keyed_children)
+            {
+                auto target_keyed = keyed_timer(target, kv.first, kv.second->note, true);
+                add_timings(*target_keyed, *kv.second, other);
+                mapping[kv.second.get()] = target_keyed.get();
+                if (kv.second->child) merge_timer(kv.second->child, target_keyed, other, mapping);
+            }
+        }
+    }
+
+    // Write the flight recorder to the next file after timer exceeded its latency threshold. A file that
+    // cannot be written takes no slot, but the recorder gives up after max_dumps failures. Called from the
+    // stop of the timer: allocation failures skip the dump instead of escaping.
+    void dump_flight_recorder(const Timer &timer) noexcept
+    {
+        if (ndumps >= max_dumps || nfailed_dumps >= max_dumps) return;
+        try
+        {
+            const auto fname = recorder_prefix + "_r" + std::to_string(rank) + "_t" +
+                               std::to_string(this_thread_index()) + "_" + std::to_string(ndumps) + ".json";
+            std::ostringstream reason;
+            reason << timer.log_name() << " took " << timer.wall_time_last() * 1e-3 << " s, threshold "
+                   << timer.latency_threshold * 1e-3 << " s";
+            std::ofstream ofs(fname);
+            if (ofs) recorder->dump(ofs, names, rank, this_thread_index(), reason.str(), clock_correction);
+            if (ofs) ofs.close();
+            if (!ofs)
+            {
+                nfailed_dumps++;
+                if (p_os)
+                    *p_os << "Warning: Cannot write the flight recorder to " << fname << " (" << reason.str() << ")"
+                          << (nfailed_dumps == max_dumps ? ", giving up" : "") << std::endl;
+                return;
+            }
+            ndumps++;
+            if (p_os) *p_os << get_timestamp() << " Flight recorder written to " << fname << ": " << reason.str() << std::endl;
+        }
+        catch (...)
+        {
+            nfailed_dumps++;
+        }
+    }
+
+    static int depth_of(const Timer &timer) noexcept
+    {
+        int depth = 0;
+        for (auto t = timer.parent; t; t = t->parent) depth++;
+        return depth;
+    }
+
+    // Write the calls of timer since the start of its summary period, and start a new period
+    void log_summary(const Timer &timer, LogWindow &w, const int64_t now_ns)
+    {
+        const auto ncalls = timer.ncalls() - w.ncalls;
+        if (ncalls > 0)
+        {
+            std::ostringstream line;
+            const auto mean_s = ticks_to_ms(timer.hot->accu - w.accu) * 1e-3 / double(ncalls);
+            line << std::setprecision(3) << " Timer " << timer.log_name() << ": " << ncalls << " calls in the last "
+                 << (now_ns - w.since_ns) * 1e-9 << " s, mean ";
+            if (mean_s < 1e-3) line << mean_s * 1e6 << " us";
+            else if (mean_s < 1.0) line << mean_s * 1e3 << " ms";
+            else line << mean_s << " s";
+            *p_os << get_timestamp() << line.str() << std::endl;
+        }
+        w.since_ns = now_ns;
+        w.ncalls = timer.ncalls();
+        w.accu = timer.hot->accu;
+    }
+
+    // Whether a transition of timer is written in full, else count it in the summary of its period
+    bool log_in_full(const Timer &timer)
+    {
+        if (log_full_transitions == 0 || depth_of(timer) <= log_always_depth) return true;
+        if (log_windows.size() <= timer.id) log_windows.resize(hot_lines.size());
+        auto &w = log_windows[timer.id];
+        if (w.logged < log_full_transitions)
+        {
+            w.logged++;
+            return true;
+        }
+        const auto now_ns = system_clock_ns();
+        if (w.logged == log_full_transitions)
+        {
+            w.logged++;
+            *p_os << get_timestamp() << " Timer " << timer.log_name() << ": logged " << log_full_transitions
+                  << " transitions, now summarized every " << log_period_s << " s" << std::endl;
+            w.since_ns = now_ns;
+            w.ncalls = timer.ncalls();
+            w.accu = timer.hot->accu;
+        }
+        else if ((now_ns - w.since_ns) * 1e-9 >= log_period_s)
+            log_summary(timer, w, now_ns);
+        return false;
+    }
+
+    // Write the timestamp and free memory of a timer transition to the verbose output
+    void log_transition(const char *what, const Timer &timer)
+    {
+        if (!p_os || !log_in_full(timer)) return;
+        *p_os << get_timestamp() << what << timer.log_name();
+#ifdef PROFILER_MEMORY_PROF
+        if (Policy::memory)
+        {
+            double free_mem_gb;
+            get_node_free_mem(free_mem_gb);
+            *p_os << ". Free memory on node [GB]: " << free_mem_gb;
+        }
+#endif
+        *p_os << std::endl;
+    }
+
+    // Read smaps_rollup, false if it is not available
+    static bool read_map(MemoryMap &map) noexcept
+    {
+#ifdef PROFILER_MEMORY_PROF
+        return read_memory_map(map) == 0;
+#else
+        (void)map;
+        return false;
+#endif
+    }
+
+    // Add the change of the memory mappings since from to a timer
+    static void add_memory_map_delta(MemoryMapSample &sample, const MemoryMap &from, const MemoryMap &to) noexcept
+    {
+        for (size_t i = 0; i < memory_map_nfields; i++) sample.delta.kb[i] += to.kb[i] - from.kb[i];
+        sample.nsamples++;
+    }
+
+    // Snapshot the timers open at a new RSS peak, open being the innermost one. A snapshot failing to
+    // allocate is dropped, the previous peak is kept.
+    void check_memory_peak(const Timer *open) noexcept
+    {
+#ifdef PROFILER_MEMORY_PROF
+        const auto generation = detail::peak_monitor().generation.load(std::memory_order_acquire);
+        if (generation == seen_peak) return;
+        seen_peak = generation;
+        try
+        {
+            MemoryPeak peak;
+            peak.rss_bytes = double(detail::peak_monitor().peak_bytes.load());
+            peak.ts_ns = detail::peak_monitor().peak_ns.load();
+            peak.snapshot_ns = system_clock_ns();
+            peak.path = open ? timer_path(open) : "";
+            if (heap_source) peak.heap = heap_source();
+            peak.npeaks = memory_peak.npeaks + 1;
+            memory_peak = std::move(peak);
+        }
+        catch (...)
+        {
+        }
+#else
+        (void)open;
+#endif
+    }
+
+    // Start the current timer
+    void start_current() noexcept
+    {
+        // the peak, if any, was reached before this call
+        if (Policy::memory) check_memory_peak(current->parent.get());
+        // read before the start, so that the read is not timed
+        if (current->memory_map && current->memory_map->at_calls) read_map(current->memory_map->start);
+        if (current->pressure) read_pressure(current->pressure->start);
+        if (recorder) recorder->record(current->name_id, 'B', current->keyed, current->key);
+        current->start();
+        detail::this_thread_activity() = {this, &current->name, current.get(), &timer_path};
+    }
+
+    // Path of a timer in the format of visit_timers, for active_timer_path
+    static std::string timer_path(const void *node)
+    {
+        std::string path;
+        for (auto t = static_cast<const Timer *>(node); t; t = t->parent.get())
+        {
+            const auto name = t->keyed ? t->name + "[" + std::to_string(t->key) + "]" : t->name;
+            path = path.empty() ? name : name + "/" + path;
+        }
+        return path;
+    }
+
+    // Stop the current timer and move to its parent. The timer across keys of a keyed call is stopped
+    // without latency check, the keyed timer has already been checked.
+    void stop_current(const bool check_latency = true) noexcept
+    {
+        if (Policy::memory) check_memory_peak(current.get());
+        const auto start = current->hot->start;
+        current->stop();
+        if (current->memory_map && current->memory_map->at_calls)
+        {
+            MemoryMap now;
+            if (read_map(now)) add_memory_map_delta(*current->memory_map, current->memory_map->start, now);
+        }
+        if (current->pressure)
+        {
+            Pressure now;
+            read_pressure(now);
+            auto &sample = *current->pressure;
+            for (size_t i = 0; i < pressure_nfields; i++) sample.delta.v[i] += now.v[i] - sample.start.v[i];
+            sample.wall_ms += current->wall_time_last();
+            sample.nsamples++;
+        }
+        if (recorder)
+        {
+            recorder->record(current->name_id, 'E', current->keyed, current->key);
+            if (check_latency && current->wall_time_last() > current->latency_threshold) dump_flight_recorder(*current);
+        }
+        distributions.record(current->id, ticks_to_ns(current->hot->last));
+        if (current->call_size() >= 0.0) current->offer_size(current->wall_time_last() * 1e-3, size_samples);
+        // A single comparison unless the call is one of the slowest
+        if (current->wall_time_last() > current->slowest_threshold())
+        {
+            current->offer_slow_call({ticks_to_ns(start) + clock_offset_ns, current->wall_time_last() * 1e-3,
+                                      this_thread_index(), rank, current->call_size()}, nslowest);
+        }
+        if (timeline)
+            events.push_back({current.get(), ticks_to_ns(start) + clock_offset_ns, ticks_to_ns(current->hot->last),
+                              this_thread_index()});
+        current = current->parent;
+        if (current)
+            detail::this_thread_activity() = {this, &current->name, current.get(), &timer_path};
+        else
+            detail::this_thread_activity() = {};
+    }
+
+    //! Accumulated cpu time (s) and wall time (ms) of the direct children of timer, not of its keys
+    static void children_time(const Timer &timer, double &cpu, double &wall) noexcept
+    {
+        cpu = wall = 0.0;
+        for (auto c = timer.child; c; c = c->next)
+        {
+            cpu += c->cpu_time_accu();
+            wall += c->wall_time_accu();
+        }
+    }
+
+    static std::string percent_string(const double part, const double whole)
+    {
+        std::ostringstream ss;
+        if (whole > 0.0) ss << std::fixed << std::setprecision(1) << 100.0 * part / whole;
+        else ss << "-";
+        return ss.str();
+    }
+
+    static std::string profile_line(const std::string &indent_s, const std::string &label, const std::string &ncalls,
+                                    const double cpu, const double wall, const double parent_wall,
+                                    const double total_wall)
+    {
+        std::ostringstream ss, cstr_cputime, cstr_walltime;
+        cstr_cputime << std::fixed << std::setprecision(4) << cpu;
+        cstr_walltime << std::fixed << std::setprecision(4) << wall;
+        ss << std::left;
+        ss << std::setw(49) << (indent_s + label) << " " << std::setw(12) << ncalls << " "
+            << std::setw(18) << (indent_s + cstr_cputime.str()) << " "
+            << std::setw(18) << (indent_s + cstr_walltime.str()) << " "
+            << std::setw(9) << percent_string(wall, parent_wall) << " "
+            << std::setw(9) << percent_string(wall, total_wall) << "\n";
+        return ss.str();
+    }
+
+    std::string get_profile_string_of_timer(std::shared_ptr<Timer> timer, const int level, const int verbose,
+                                            const double parent_wall, const double total_wall)
+    {
+        std::ostringstream ss;
+        // std::string indent(2 * level, ' ');
+        std::string indent_s(this->indent * level, ' ');
+        const auto wall = timer->wall_time_accu();
+
+        // Print self
+        ss << profile_line(indent_s, timer->label(), std::to_string(timer->ncalls()), timer->cpu_time_accu(), wall,
+                           parent_wall, total_wall);
+        // Print keys in order, then child and the time not covered by the children, then sibling
+        if (timer->keyed_children && verbose > level)
+        {
+            std::map<int64_t, std::shared_ptr<Timer>> sorted(timer->keyed_children->begin(),
+                                                             timer->keyed_children->end());
+            for (const auto &kv: sorted)
+                ss << get_profile_string_of_timer(kv.second, level + 1, verbose, wall, total_wall);
+        }
+        if (timer->child && verbose > level)
+        {
+            ss << get_profile_string_of_timer(timer->child, level + 1, verbose, wall, total_wall);
+            // Children merged from other threads can overlap and exceed their parent, marked instead of a
+            // negative time
+            double children_cpu, children_wall;
+            children_time(*timer, children_cpu, children_wall);
+            ss << profile_line(std::string(this->indent * (level + 1), ' '),
+                               children_wall > wall ? "<children exceed parent>" : "<unaccounted>", "",
+                               std::max(0.0, timer->cpu_time_accu() - children_cpu),
+                               std::max(0.0, wall - children_wall), wall, total_wall);
+        }
+        if (timer->next && verbose >= level)
+            ss << get_profile_string_of_timer(timer->next, level, verbose, parent_wall, total_wall);
+        return ss.str();
+    }
+
+    // Call f(timer, level, path) for timer, its siblings and their subtrees in pre-order
+    template <typename F>
+    static void visit_timers(const std::shared_ptr<Timer> &timer, const int level, const std::string &prefix, F &&f)
+    {
+        for (auto t = timer; t; t = t->next)
+        {
+            const auto name = t->keyed ? t->name + "[" + std::to_string(t->key) + "]" : t->name;
+            const auto path = prefix.empty() ? name : prefix + "/" + name;
+            f(*t, level, path);
+            if (t->keyed_children)
+            {
+                std::map<int64_t, std::shared_ptr<Timer>> sorted(t->keyed_children->begin(), t->keyed_children->end());
+                for (const auto &kv: sorted)
+                    visit_timers(kv.second, level + 1, path, f);
+            }
+            if (t->child) visit_timers(t->child, level + 1, path, f);
+        }
+    }
+
+    std::string get_model_string_of_timer(std::shared_ptr<Timer> timer, const int level, const double size)
+    {
+        std::ostringstream ss;
+        ss << std::left;
+        for (auto t = timer; t; t = t->next)
+        {
+            std::string indent_s(this->indent * level, ' ');
+            if (t->size_samples())
+            {
+                const auto fit = fit_complexity(t->size_samples()->samples);
+                ss << std::setw(37) << (indent_s + t->label()) << " " << std::setw(9) << t->size_samples()->samples.size()
+                   << " ";
+                if (fit.valid)
+                {
+                    std::ostringstream cstr_rms, cstr_exp, cstr_pred;
+                    cstr_rms << std::fixed << std::setprecision(1) << 100.0 * fit.rms;
+                    cstr_exp << std::fixed << std::setprecision(2) << fit.exponent;
+                    cstr_pred << std::scientific << std::setprecision(3) << fit.predict(size);
+                    ss << std::setw(10) << ("O(" + fit.model + ")") << " " << std::setw(9) << cstr_rms.str() << " "
+                       << std::setw(10) << cstr_exp.str() << " " << std::setw(18) << cstr_pred.str() << "\n";
+                }
+                else
+                    ss << "too few distinct sizes\n";
+            }
+            if (t->keyed_children)
+            {
+                std::map<int64_t, std::shared_ptr<Timer>> sorted(t->keyed_children->begin(), t->keyed_children->end());
+                for (const auto &kv: sorted)
+                    ss << get_model_string_of_timer(kv.second, level + 1, size);
+            }
+            if (t->child) ss << get_model_string_of_timer(t->child, level + 1, size);
+        }
+        return ss.str();
+    }
+
+public:
+    //! Indent for printing final statistics
+    unsigned int indent;
+    //! Number of (size, time) samples kept per timer for get_model_string
+    size_t size_samples = 64;
+
+    BasicProfiler()
+        : p_os(nullptr), clock_offset_ns(detail::clock_offset_ns<clock>()), root(nullptr), current(nullptr), ndumps(0),
+          max_dumps(0), nfailed_dumps(0), rank(0), nclock_samples(0), nslowest(0), timeline(false), seen_peak(0),
+          log_full_transitions(0), log_period_s(10.0), log_always_depth(-1), indent(1) {};
+    BasicProfiler(std::ostream &os_in)
+        : p_os(&os_in), clock_offset_ns(detail::clock_offset_ns<clock>()), root(nullptr), current(nullptr), ndumps(0),
+          max_dumps(0), nfailed_dumps(0), rank(0), nclock_samples(0), nslowest(0), timeline(false), seen_peak(0),
+          log_full_transitions(0), log_period_s(10.0), log_always_depth(-1), indent(1) {};
+
+    //! In the verbose log, write the first full_transitions starts and stops of each timer, then one line
+    //! per period seconds with its number of calls and mean time. Timers at depth always_depth or less
+    //! (0 for the top level, -1 for none) are always logged in full. 0 full transitions logs every call.
+    void coalesce_log(const size_t full_transitions = 100, const double period = 10.0, const int always_depth = -1)
+    {
+        log_full_transitions = full_transitions;
+        log_period_s = period;
+        log_always_depth = always_depth;
+    }
+
+    //! Write the summary lines of the calls not yet reported by the coalesced log
+    void flush_log()
+    {
+        if (!p_os) return;
+        const auto now_ns = system_clock_ns();
+        visit_timers(root, 0, "", [&](const Timer &t, const int, const std::string &) {
+            if (t.id < log_windows.size() && log_windows[t.id].logged > log_full_transitions)
+                log_summary(t, log_windows[t.id], now_ns);
+        });
+    }
+
+    ~BasicProfiler()
+    {
+        auto &activity = detail::this_thread_activity();
+        if (activity.owner == this) activity = {};
+    }
+
+    //! Movable, e.g. for auto profiler = Profiler() before C++17, but not while a timer is running:
+    //! the running timer stays attributed to the moved-from profiler (see active_timer_name)
+    BasicProfiler(BasicProfiler &&) = default;
+    BasicProfiler &operator=(BasicProfiler &&) = default;
+
+    //! Add a timer
+    void add(const std::string &tname, const std::string &tnote = "") noexcept
+    {
+        auto new_timer = make_timer(tname, tnote);
+        link_timer(new_timer, current);
+        current = new_timer;
+    }
+
+    //! Start a timer. If the timer is not added before, add it.
+    void start(const std::string &tname, const std::string &tnote = "") noexcept
+    {
+        // if (omp_get_thread_num() != 0) return;
+        auto timer = find_timer_in_hierarchy(tname);
+        // create a new timer if it is not found, otherwise we move to that timer and start
+        if (!timer)
+        {
+            add(tname, tnote);
+        }
+        else
+        {
+            current = timer;
+        }
+        log_transition(" Timer start: ", *current);
+        start_current();
+    }
+
+    //! Start the timer of an integer key, e.g. a k-point or block index.
+    //! The timer without key accumulates the calls of all keys.
+    void start(const std::string &tname, const int64_t key, const std::string &tnote = "") noexcept
+    {
+        auto timer = find_timer_in_hierarchy(tname);
+        if (!timer)
+            add(tname);
+        else
+            current = timer;
+        start_current();
+        current = keyed_timer(current, key, tnote, true);
+        log_transition(" Timer start: ", *current);
+        start_current();
+    }
+
+    //! Stop a timer and record the timing
+    void stop(const std::string &tname) noexcept
+    {
+        // if (omp_get_thread_num() != 0) return;
+        if (current)
+        {
+            // Check if the current timer matches the given timer name
+            if (current->name == tname)
+            {
+                if (current->keyed)
+                {
+                    stop(tname, current->key);
+                    return;
+                }
+                // Logged after the stop, so that the log is not part of the timing
+                const auto timer = current;
+                stop_current();
+                log_transition(" Timer stop:  ", *timer);
+            }
+            else
+            {
+                if (p_os)
+                    *p_os << "Warning: Attempting to stop timer '" << tname
+                          << "' but current active timer is '" << current->log_name() << "'" << std::endl;
+            }
+        }
+        else
+        {
+            if (p_os) *p_os << "Warning: No timer is currently active" << std::endl;
+        }
+    }
+
+    //! Stop the timer of an integer key
+    void stop(const std::string &tname, const int64_t key) noexcept
+    {
+        if (current && current->keyed && current->key == key && current->name == tname)
+        {
+            const auto timer = current;
+            stop_current();
+            log_transition(" Timer stop:  ", *timer);
+            stop_current(false);
+        }
+        else if (current)
+        {
+            if (p_os)
+                *p_os << "Warning: Attempting to stop timer '" << tname << "[" << key
+                      << "]' but current active timer is '" << current->log_name() << "'" << std::endl;
+        }
+        else
+        {
+            if (p_os) *p_os << "Warning: No timer is currently active" << std::endl;
+        }
+    }
+
+    //! Get cpu time of last call of timer
+    double get_cpu_time_last(const std::string &tname) noexcept
+    {
+        auto timer = this->find_timer_in_hierarchy(tname);
+        if (timer)
+            return timer->cpu_time_last();
+        return -1.0;
+    }
+
+    //! Get wall time of last call of timer
+    double get_wall_time_last(const std::string &tname) noexcept
+    {
+        auto timer = this->find_timer_in_hierarchy(tname);
+        if (timer)
+            return timer->wall_time_last();
+        return 0.0;
+    }
+
+    //! Get cpu time of last call of timer with key
+    double get_cpu_time_last(const std::string &tname, const int64_t key) noexcept
+    {
+        auto timer = this->find_timer_in_hierarchy(tname);
+        if (timer) timer = keyed_timer(timer, key, "", false);
+        if (timer)
+            return timer->cpu_time_last();
+        return -1.0;
+    }
+
+    //! Get wall time of last call of timer with key
+    double get_wall_time_last(const std::string &tname, const int64_t key) noexcept
+    {
+        auto timer = this->find_timer_in_hierarchy(tname);
+        if (timer) timer = keyed_timer(timer, key, "", false);
+        if (timer)
+            return timer->wall_time_last();
+        return 0.0;
+    }
+
+    //! Handle of the timer tname found as get_wall_time_last does, invalid if there is no such timer
+    TimerHandle handle(const std::string &tname) noexcept
+    {
+        TimerHandle h;
+        const auto timer = this->find_timer_in_hierarchy(tname);
+        if (timer) h.id = timer->id;
+        return h;
+    }
+
+    //! Handle of the timer tname with key, invalid if there is no such timer
+    TimerHandle handle(const std::string &tname, const int64_t key) noexcept
+    {
+        TimerHandle h;
+        auto timer = this->find_timer_in_hierarchy(tname);
+        if (timer) timer = keyed_timer(timer, key, "", false);
+        if (timer) h.id = timer->id;
+        return h;
+    }
+
+    //! Whether h is a timer of this profiler. Handles of another profiler are only checked against the
+    //! number of timers of this one.
+    bool owns(const TimerHandle h) const noexcept { return h.id < hot_lines.size(); }
+
+    //! Number of calls, accumulated cpu time (s) and wall time (ms) of the timer of handle h, 0 if invalid
+    uint64_t get_ncalls(const TimerHandle h) const noexcept { return owns(h) ? hot_lines[h.id].ncalls : 0; }
+    double get_cpu_time(const TimerHandle h) const noexcept { return owns(h) ? hot_lines[h.id].cpu_time_accu() : 0.0; }
+    double get_wall_time(const TimerHandle h) const noexcept
+    {
+        return owns(h) ? ticks_to_ms(hot_lines[h.id].accu) : 0.0;
+    }
+
+    //! Get cpu time (s) of last call of the timer of handle h, -1 if invalid
+    double get_cpu_time_last(const TimerHandle h) const noexcept
+    {
+        return owns(h) ? hot_lines[h.id].cpu_time_last() : -1.0;
+    }
+
+    //! Get wall time (ms) of last call of the timer of handle h, 0 if invalid
+    double get_wall_time_last(const TimerHandle h) const noexcept
+    {
+        return owns(h) ? ticks_to_ms(hot_lines[h.id].last) : 0.0;
+    }
+
+    //! Fill snap with the accumulators of all the timers in one pass over the hot lines, by node ID,
+    //! in the units of the handle getters. Only allocates when there are more timers than in the
+    //! previous snapshot.
+    void snapshot(Snapshot &snap) const
+    {
+        const auto n = hot_lines.size();
+        snap.path_id.resize(n);
+        snap.ncalls.resize(n);
+        snap.cpu_time.resize(n);
+        snap.wall_time.resize(n);
+        snap.cpu_last.resize(n);
+        snap.wall_last.resize(n);
+        snap.min_time.resize(n);
+        snap.max_time.resize(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            const auto &line = hot_lines[i];
+            snap.path_id[i] = uint32_t(i);
+            snap.ncalls[i] = line.ncalls;
+            snap.cpu_time[i] = line.cpu_time_accu();
+            snap.wall_time[i] = ticks_to_ms(line.accu);
+            snap.cpu_last[i] = line.cpu_time_last();
+            snap.wall_last[i] = ticks_to_ms(line.last);
+            snap.min_time[i] = distributions.min_time(uint32_t(i)) * 1e3;
+            snap.max_time[i] = distributions.max_time(uint32_t(i)) * 1e3;
+        }
+    }
+
+    //! Path of each node ID, as in save, to label the arrays of a snapshot
+    std::vector<std::string> node_paths() const
+    {
+        std::vector<std::string> paths(hot_lines.size());
+        visit_timers(root, 0, "", [&paths](const Timer &t, const int, const std::string &path) { paths[t.id] = path; });
+        return paths;
+    }
+
+    //! Count floating-point operations of the running call of the current timer
+    void add_flops(const double flops) noexcept
+    {
+        if (current) current->add_flops(flops);
+    }
+
+    //! Count bytes moved from or to memory by the running call of the current timer
+    void add_bytes(const double bytes) noexcept
+    {
+        if (current) current->add_bytes(bytes);
+    }
+
+    //! Get the position of the timers with counted flops and bytes on the roofline of machine
+    std::string get_roofline_string(const MachineBalance &machine) const
+    {
+        std::ostringstream output;
+        output << std::left;
+        output << "Roofline: " << machine.bandwidth << " GB/s, peak " << machine.scalar_gflops << " (scalar) / "
+            << machine.simd_gflops << " (SIMD) GFLOP/s with " << machine.nthreads << " threads\n";
+        output << banner('-', 100) << "\n";
+        output << std::setw(41) << "Entry" << " " << std::setw(11) << "AI (F/B)" << " " << std::setw(11) << "GFLOP/s" << " "
+            << std::setw(11) << "Attainable" << " " << std::setw(11) << "% of roof" << " " << std::setw(10) << "Bound" << "\n";
+        output << banner('-', 100) << "\n";
+        output << std::fixed;
+        visit_timers(root, 0, "", [&](const Timer &t, const int level, const std::string &) {
+            if (t.flops() <= 0.0 || t.bytes() <= 0.0 || t.wall_time_accu() <= 0.0) return;
+            const auto ai = t.flops() / t.bytes();
+            const auto gflops = t.flops() / (t.wall_time_accu() * 1e-3) * 1e-9;
+            const auto roof = machine.attainable(ai);
+            output << std::setw(41) << (std::string(this->indent * level, ' ') + t.label()) << " "
+                << std::setprecision(3) << std::setw(11) << ai << " " << std::setw(11) << gflops << " "
+                << std::setw(11) << roof << " " << std::setprecision(1) << std::setw(11) << 100.0 * gflops / roof << " "
+                << std::setw(10) << (ai * machine.bandwidth < machine.simd_gflops ? "memory" : "compute") << "\n";
+        });
+        output << banner('-', 100) << "\n";
+        return output.str();
+    }
+
+    //! Write the roofline position of the timers with counted flops and bytes as CSV for plotting
+    void write_roofline_csv(std::ostream &os, const MachineBalance &machine) const
+    {
+        os << "# bandwidth_gbs=" << machine.bandwidth << ",scalar_gflops=" << machine.scalar_gflops
+           << ",simd_gflops=" << machine.simd_gflops << ",nthreads=" << machine.nthreads << "\n";
+        os << "path,ncalls,wall_time,flops,bytes,intensity,gflops,attainable_gflops\n";
+        visit_timers(root, 0, "", [&](const Timer &t, const int, const std::string &path) {
+            if (t.flops() <= 0.0 || t.bytes() <= 0.0 || t.wall_time_accu() <= 0.0) return;
+            const auto ai = t.flops() / t.bytes();
+            std::string quoted = path;
+            for (auto &c: quoted)
+                if (c == '"') c = '\'';
+            os << "\"" << quoted << "\"," << t.ncalls() << "," << t.wall_time_accu() * 1e-3 << "," << t.flops() << ","
+               << t.bytes() << "," << ai << "," << t.flops() / (t.wall_time_accu() * 1e-3) * 1e-9 << ","
+               << machine.attainable(ai) << "\n";
+        });
+    }
+
+    //! Keep the last nevents starts and stops in a ring, written in Chrome trace format to
+    //! prefix_r<rank>_t<thread>_<n>.json when a timer exceeds its latency threshold, at most max_files times
+    void enable_flight_recorder(const size_t nevents = 4096, const std::string &prefix = "flight",
+                                const size_t max_files = 16)
+    {
+        recorder.reset(new FlightRecorder(nevents));
+        recorder_prefix = prefix;
+        max_dumps = max_files;
+        ndumps = 0;
+        nfailed_dumps = 0;
+    }
+
+    //! Dump the flight recorder when a call of timer tname takes longer than seconds
+    void set_latency_threshold(const std::string &tname, const double seconds)
+    {
+        const auto id = intern(tname);
+        latency_thresholds[id] = seconds * 1e3;
+        visit_timers(root, 0, "", [&](Timer &t, const int, const std::string &) {
+            if (t.name_id == id) t.latency_threshold = seconds * 1e3;
+        });
+    }
+
+    //! Set the rank of the process, recorded with the slowest calls and in the metadata
+    void set_rank(const int r)
+    {
+        rank = r;
+        set_metadata("rank", std::to_string(r));
+    }
+
+    //! Add a measurement of the offset of the local clock to the reference clock, see profiler_mpi.h.
+    //! Trace timestamps are then mapped to the reference clock with the offset of the first sample
+    //! and the drift between the first and the last sample.
+    void add_clock_sample(const ClockSample &sample)
+    {
+        if (nclock_samples++ == 0) first_clock_sample = sample;
+        const auto &first = first_clock_sample;
+        clock_correction.t0_ns = first.local_ns;
+        clock_correction.offset_ns = first.offset_ns;
+        // Drift from samples at least 1 ms apart only, the offset errors would dominate otherwise
+        if (sample.local_ns - first.local_ns > 1000000)
+            clock_correction.drift = (sample.offset_ns - first.offset_ns) / double(sample.local_ns - first.local_ns);
+        std::ostringstream offset, drift;
+        offset << clock_correction.offset_ns;
+        drift << clock_correction.drift;
+        set_metadata("clock_offset_ns", offset.str());
+        set_metadata("clock_drift", drift.str());
+    }
+
+    //! Get the correction applied to the trace timestamps
+    const ClockCorrection &get_clock_correction() const noexcept { return clock_correction; }
+
+    //! Keep the k slowest calls of each timer, with their start time, thread, rank and size tag.
+    //! Calls already kept are discarded.
+    void keep_slowest_calls(const size_t k)
+    {
+        nslowest = k;
+        visit_timers(root, 0, "", [&](Timer &t, const int, const std::string &) {
+            t.keep_slowest(k);
+        });
+    }
+
+    //! Get the slowest calls of each timer, slowest first
+    std::string get_slowest_calls_string() const
+    {
+        std::ostringstream output;
+        output << std::left;
+        output << banner('-', 100) << "\n";
+        output << std::setw(41) << "Entry / Start" << " " << std::setw(18) << "Wall time (s)" << " "
+            << std::setw(8) << "Thread" << " " << std::setw(8) << "Rank" << " " << std::setw(18) << "Size" << "\n";
+        output << banner('-', 100) << "\n";
+        visit_timers(root, 0, "", [&](const Timer &t, const int level, const std::string &) {
+            if (!t.slowest_calls() || t.slowest_calls()->empty()) return;
+            const std::string indent_s(this->indent * level, ' ');
+            output << indent_s << t.label() << "\n";
+            auto calls = *t.slowest_calls();
+            std::sort(calls.begin(), calls.end(), detail::slower_call);
+            for (const auto &c: calls)
+            {
+                std::ostringstream cstr_walltime;
+                cstr_walltime << std::fixed << std::setprecision(6) << c.duration;
+                const std::chrono::time_point<std::chrono::system_clock> tp{
+                    std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(c.ts_ns))};
+                output << std::setw(41) << (indent_s + " " + format_timestamp(tp)) << " " << std::setw(18)
+                    << cstr_walltime.str() << " " << std::setw(8) << c.tid << " " << std::setw(8) << c.rank << " ";
+                if (c.size >= 0.0)
+                    output << c.size;
+                output << "\n";
+            }
+        });
+        output << banner('-', 100) << "\n";
+        return output.str();
+    }
+
+    //! Set a metadata entry written by save(), e.g. ("threads", "16")
+    void set_metadata(const std::string &key, const std::string &value)
+    {
+        metadata[sanitize_field(key)] = sanitize_field(value);
+    }
+
+    //! Write the accumulated timings in a tab-separated format that can be read with load_profile.
+    //! Each line holds depth, path, ncalls, cpu time (s), wall time (s) and note of a timer.
+    void save(std::ostream &os) const
+    {
+        const auto flags = os.flags();
+        const auto precision = os.precision();
+        os << std::setprecision(9);
+        os << saved_profile_header << "\n";
+        for (const auto &kv: metadata)
+            os << "# " << kv.first << "\t" << kv.second << "\n";
+        visit_timers(root, 0, "", [&](const Timer &t, const int level, const std::string &path) {
+            os << level << "\t" << sanitize_field(path) << "\t" << t.ncalls() << "\t" << t.cpu_time_accu() << "\t"
+               << t.wall_time_accu() * 1e-3 << "\t" << sanitize_field(t.note) << "\n";
+        });
+        os.flags(flags);
+        os.precision(precision);
+    }
+
+    //! Tag the running call of the current timer with its problem size, e.g. N, nnz or bytes
+    void tag_size(const double size) noexcept
+    {
+        if (current && current->is_on()) current->set_call_size(size);
+    }
+
+    //! Get the complexity fits of timers tagged with problem sizes, with the time predicted at size
+    std::string get_model_string(const double size) noexcept
+    {
+        std::ostringstream output;
+        output << std::left;
+
+        std::ostringstream cstr_size;
+        cstr_size << std::setprecision(4) << size;
+        output << banner('-', 100) << "\n";
+        output << std::setw(37) << "Entry" << " " << std::setw(9) << "#samples" << " " << std::setw(10) << "Model" << " "
+            << std::setw(9) << "RMS (%)" << " " << std::setw(10) << "Exponent" << " "
+            << std::setw(18) << ("Time (s) at " + cstr_size.str()) << "\n";
+        output << banner('-', 100) << "\n";
+        if (root) output << get_model_string_of_timer(root, 0, size);
+        output << banner('-', 100) << "\n";
+
+        return output.str();
+    }
+
+    //! Sample the RSS of the process every period seconds in a background thread. At each peak higher than
+    //! the previous one by min_growth, the next start or stop records the open timers and the heap source.
+    //! The report gives the delay from the sample of the peak to that start or stop, during which the open
+    //! timers and the live heap may have changed.
+    //! Needs PROFILER_MEMORY_PROF and a policy with memory.
+    void enable_peak_tracking(const double period = 0.01, const double min_growth = 0.02)
+    {
+#ifdef PROFILER_MEMORY_PROF
+        if (Policy::memory) detail::peak_monitor().start(period, min_growth);
+#else
+        (void)period;
+        (void)min_growth;
+#endif
+    }
+
+    //! Source of the live heap bytes by timer path at the memory peaks, e.g. Profiler::heap::live_bytes_by_timer
+    void set_heap_source(std::function<std::map<std::string, double>()> source) { heap_source = std::move(source); }
+
+    //! Get the timers open at the highest RSS peak, and the live heap they owned
+    std::string get_memory_peak_string() const
+    {
+        std::ostringstream output;
+        output << std::left;
+        if (memory_peak.npeaks == 0)
+        {
+            output << "No memory peak recorded\n";
+            return output.str();
+        }
+        double max_bytes = memory_peak.rss_bytes;
+#ifdef PROFILER_MEMORY_PROF
+        max_bytes = std::max(max_bytes, double(detail::peak_monitor().max_bytes.load()));
+#endif
+        const auto gb = [](const double bytes) {
+            std::ostringstream ss;
+            ss << std::fixed << std::setprecision(3) << bytes * 1e-9;
+            return ss.str();
+        };
+        // Live heap of a timer and its children
+        const auto owned = [&](const std::string &path) {
+            double bytes = 0.0;
+            for (const auto &kv: memory_peak.heap)
+                if (kv.first.compare(0, path.size(), path) == 0 &&
+                    (kv.first.size() == path.size() || kv.first[path.size()] == '/'))
+                    bytes += kv.second;
+            return bytes;
+        };
+        double heap = 0.0;
+        for (const auto &kv: memory_peak.heap) heap += kv.second;
+
+        std::vector<std::string> open;
+        for (size_t pos = 0; pos <= memory_peak.path.size() && !memory_peak.path.empty();)
+        {
+            const auto slash = memory_peak.path.find('/', pos);
+            open.push_back(memory_peak.path.substr(0, slash));
+            if (slash == std::string::npos) break;
+            pos = slash + 1;
+        }
+        const auto ts = std::chrono::system_clock::time_point(std::chrono::duration_cast<
+            std::chrono::system_clock::duration>(std::chrono::nanoseconds(memory_peak.ts_ns)));
+        std::ostringstream delay;
+        delay << std::fixed << std::setprecision(3) << double(memory_peak.snapshot_ns - memory_peak.ts_ns) * 1e-6;
+        output << "At peak (" << gb(memory_peak.rss_bytes) << " GB RSS) " << format_timestamp(ts);
+        if (!open.empty() && !memory_peak.heap.empty())
+            output << ", these timers were active and owned " << gb(owned(open.front())) << " GB of "
+                   << gb(heap) << " GB live heap";
+        else if (!open.empty())
+            output << ", these timers were active";
+        output << "\nTimers and heap taken at the next start or stop, " << delay.str() << " ms after the peak sample";
+        output << "\nHighest RSS sampled " << gb(max_bytes) << " GB, " << memory_peak.npeaks << " peaks\n";
+        output << banner('-', 100) << "\n";
+        output << std::setw(61) << "Entry" << " " << std::setw(18) << "Live heap (GB)" << " " << std::setw(10)
+               << "(%)" << "\n";
+        output << banner('-', 100) << "\n";
+        const auto print = [&](const std::string &path, const double bytes) {
+            std::ostringstream cstr_share;
+            cstr_share << std::fixed << std::setprecision(1) << (heap > 0.0 ? 100.0 * bytes / heap : 0.0);
+            output << std::setw(61) << path << " " << std::setw(18) << (memory_peak.heap.empty() ? "-" : gb(bytes))
+                   << " " << std::setw(10) << (memory_peak.heap.empty() ? "-" : cstr_share.str()) << "\n";
+        };
+        for (const auto &path: open) print(path, owned(path));
+        output << banner('-', 100) << "\n";
+        if (memory_peak.heap.empty()) return output.str();
+
+        // Timers not open at the peak that still owned live heap, e.g. allocated in a setup phase
+        std::vector<std::pair<double, std::string>> owners;
+        for (const auto &kv: memory_peak.heap)
+            if (std::find(open.begin(), open.end(), kv.first) == open.end()) owners.push_back({kv.second, kv.first});
+        std::sort(owners.rbegin(), owners.rend());
+        if (owners.size() > 5) owners.resize(5);
+        for (const auto &o: owners) print(o.second + " (closed)", o.first);
+        if (!owners.empty()) output << banner('-', 100) << "\n";
+        return output.str();
+    }
+
+    //! Read /proc/self/smaps_rollup at each start and stop of the timers named tname, and sum the changes.
+    //! A read costs the walk of all the mappings of the process by the kernel, so only enable it for
+    //! timers of at least milliseconds. Needs PROFILER_MEMORY_PROF, Linux only.
+    void enable_memory_map(const std::string &tname)
+    {
+        const auto id = intern(tname);
+        memory_map_names.insert(id);
+        visit_timers(root, 0, "", [&](Timer &t, const int, const std::string &) {
+            if (t.name_id != id) return;
+            if (!t.memory_map) t.memory_map.reset(new MemoryMapSample());
+            t.memory_map->at_calls = true;
+        });
+    }
+
+    //! Attribute the change of smaps_rollup since the previous call to the running timer, e.g. once per
+    //! iteration or from a periodic callback. The first call only takes the reference.
+    void sample_memory_map()
+    {
+        MemoryMap now;
+        if (!read_map(now)) return;
+        if (last_memory_map && current)
+        {
+            if (!current->memory_map) current->memory_map.reset(new MemoryMapSample());
+            add_memory_map_delta(*current->memory_map, *last_memory_map, now);
+        }
+        if (!last_memory_map) last_memory_map.reset(new MemoryMap());
+        *last_memory_map = now;
+    }
+
+    //! Get the changes of the memory mappings of the sampled timers, in MB summed over the samples
+    std::string get_memory_map_string() const
+    {
+        std::ostringstream output;
+        output << std::left;
+        output << banner('-', 100) << "\n";
+        output << std::setw(36) << "Entry" << " " << std::setw(8) << "#samples";
+        for (const auto *c: {"Rss", "Anon", "THP", "Shared", "Private", "Swap"}) output << " " << std::setw(8) << c;
+        output << "\n" << banner('-', 100) << "\n";
+        visit_timers(root, 0, "", [&](const Timer &t, const int level, const std::string &) {
+            if (!t.memory_map || t.memory_map->nsamples == 0) return;
+            const auto &kb = t.memory_map->delta.kb;
+            // Rss, Anonymous, AnonHugePages, Shared_*, Private_*, Swap
+            const int64_t columns[] = {kb[0], kb[1], kb[2], kb[3] + kb[4], kb[5] + kb[6], kb[7]};
+            output << std::setw(36) << (std::string(indent * level, ' ') + t.label()) << " " << std::setw(8)
+                   << t.memory_map->nsamples;
+            for (const auto c: columns)
+            {
+                std::ostringstream cstr_mb;
+                cstr_mb << std::fixed << std::setprecision(1) << std::showpos << c / 1024.0;
+                output << " " << std::setw(8) << cstr_mb.str();
+            }
+            output << "\n";
+        });
+        output << banner('-', 100) << "\n";
+        return output.str();
+    }
+
+    //! Keep the hot accumulators and the timer tree in a shared mapping of fname, so that
+    //! tools/read_mapped.cpp can read the profile even after the process is killed, e.g. by the OOM killer.
+    //! The hot path is unchanged. Must be called before the first timer, returns false otherwise or on error.
+    bool enable_persistent(const std::string &fname)
+    {
+#if defined(__unix__) || defined(__APPLE__)
+        if (mapped || hot_lines.size() > 0) return false;
+        const auto page = size_t(sysconf(_SC_PAGESIZE));
+        const auto round_up = [page](const size_t n) { return (n + page - 1) / page * page; };
+        const auto chunk_nodes = detail::LineArena<Hot>::chunk_size;
+        Hot line;
+        const auto offset = [&line](const void *field) {
+            return field ? int32_t(static_cast<const char *>(field) - reinterpret_cast<const char *>(&line)) : -1;
+        };
+        MappedHeader layout;
+        std::memset(static_cast<void *>(&layout), 0, sizeof(layout));
+        layout.version = 1;
+        layout.header_size = uint32_t(round_up(sizeof(MappedHeader)));
+        layout.segment_size = uint32_t(round_up(chunk_nodes * (sizeof(Hot) + sizeof(MappedNode))));
+        layout.chunk_nodes = uint32_t(chunk_nodes);
+        layout.line_size = uint32_t(sizeof(Hot));
+        layout.node_size = uint32_t(sizeof(MappedNode));
+        layout.off_start = offset(&line.start);
+        layout.off_ncalls = offset(&line.ncalls);
+        layout.off_accu = offset(&line.accu);
+        layout.off_seq = offset(&line.seq);
+        layout.off_cpu_accu = offset(line.cpu_accu_field());
+        layout.pid = int32_t(getpid());
+        layout.ns_per_tick = 1e9 * double(clock::period::num) / double(clock::period::den);
+        layout.clock_offset_ns = clock_offset_ns;
+        layout.created_ns = system_clock_ns();
+        mapped = detail::MappedProfile::create(fname, layout);
+        if (!mapped) return false;
+        auto *m = mapped.get();
+        hot_lines.set_chunk_source([m](const size_t k) { return m->segment(k); });
+        return true;
+#else
+        (void)fname;
+        return false;
+#endif
+    }
+
+    //! Read the CPU throttling and stall counters of the cgroup and the steal time at each start and stop
+    //! of the timers named tname. A read costs a few system calls. Linux only.
+    void enable_pressure(const std::string &tname)
+    {
+        const auto id = intern(tname);
+        pressure_names.insert(id);
+        visit_timers(root, 0, "", [&](Timer &t, const int, const std::string &) {
+            if (t.name_id == id && !t.pressure) t.pressure.reset(new PressureSample());
+        });
+    }
+
+    //! Get the share of the wall time of the sampled timers lost to CPU throttling, to stalls on CPU and
+    //! memory (PSI, some or full tasks of the cgroup) and to the hypervisor (steal time per CPU)
+    std::string get_pressure_string() const
+    {
+        std::ostringstream output;
+        output << std::left;
+        output << banner('-', 100) << "\n";
+        output << std::setw(31) << "Entry" << " " << std::setw(8) << "#calls" << " " << std::setw(10)
+               << "#throttled" << " " << std::setw(10) << "Thrott (%)" << " " << std::setw(8) << "CPU (%)" << " "
+               << std::setw(8) << "Mem (%)" << " " << std::setw(9) << "Mem full" << " " << std::setw(9)
+               << "Steal (%)" << "\n";
+        output << banner('-', 100) << "\n";
+        long ncpus = 1;
+#if defined(__linux__)
+        ncpus = std::max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+#endif
+        visit_timers(root, 0, "", [&](const Timer &t, const int level, const std::string &) {
+            if (!t.pressure || t.pressure->nsamples == 0) return;
+            const auto &v = t.pressure->delta.v;
+            const double wall_us = std::max(1.0, t.pressure->wall_ms * 1e3);
+            const auto percent = [&](const double us) {
+                std::ostringstream ss;
+                ss << std::fixed << std::setprecision(1) << 100.0 * us / wall_us;
+                return ss.str();
+            };
+            output << std::setw(31) << (std::string(indent * level, ' ') + t.label()) << " " << std::setw(8)
+                   << t.pressure->nsamples << " " << std::setw(10) << v[0] << " " << std::setw(10) << percent(v[1])
+                   << " " << std::setw(8) << percent(v[2]) << " " << std::setw(8) << percent(v[3]) << " "
+                   << std::setw(9) << percent(v[4]) << " " << std::setw(9) << percent(double(v[5]) / ncpus) << "\n";
+        });
+        output << banner('-', 100) << "\n";
+        return output.str();
+    }
+
+    //! Record every timer call for write_chrome_trace
+    void enable_timeline(bool on = true) noexcept { timeline = on; }
+
+    //! Capture the running timer so that work on other threads can be attached to it with adopt()
+    SpanContext capture_span() const
+    {
+        SpanContext ctx;
+        for (auto t = current; t; t = t->parent)
+        {
+            if (t->remote)
+            {
+                ctx.path.insert(ctx.path.begin(), t->span_path.begin(), t->span_path.end());
+                break;
+            }
+            PathEntry entry;
+            entry.name = t->name;
+            entry.keyed = t->keyed;
+            entry.key = t->key;
+            ctx.path.insert(ctx.path.begin(), entry);
+        }
+        ctx.ts_ns = system_clock_ns();
+        ctx.tid = this_thread_index();
+        return ctx;
+    }
+
+    //! Nest the following timers of this profiler under the timer captured in ctx, usually on a worker thread.
+    //! Nothing is shared with the spawning profiler until merge() is called.
+    void adopt(const SpanContext &ctx)
+    {
+        std::shared_ptr<Timer> anchor;
+        for (auto t = root; t; t = t->next)
+            if (t->remote && t->span_path == ctx.path) anchor = t;
+        if (!anchor)
+        {
+            const auto tname = ctx.path.empty() ? std::string() : ctx.path.back().name;
+            anchor = make_timer(tname, "");
+            anchor->remote = true;
+            anchor->span_path = ctx.path;
+            link_timer(anchor, nullptr);
+        }
+        current = anchor;
+        if (timeline)
+        {
+            // Both ends are kept here, so the spawning profiler is not touched
+            static std::atomic<uint64_t> nflows{0};
+            const auto id = ++nflows;
+            flows.push_back({id, ctx.ts_ns, ctx.tid, 's'});
+            flows.push_back({id, system_clock_ns(), this_thread_index(), 'f'});
+        }
+    }
+
+    //! Add the timings and timeline of another profiler, e.g. of a joined worker thread.
+    //! Work adopted from a span of this profiler is nested under the spawning timer.
+    void merge(const BasicProfiler &other)
+    {
+        std::map<const Timer *, const Timer *> mapping;
+        if (other.root) merge_timer(other.root, nullptr, other, mapping);
+        for (const auto &e: other.events)
+            events.push_back({mapping[e.timer], e.ts_ns, e.dur_ns, e.tid});
+        flows.insert(flows.end(), other.flows.begin(), other.flows.end());
+    }
+
+    // Set nodes[timer ID] to the table node of timer, its siblings and their subtrees, in pre-order.
+    // labels caches the table name ID of each interned name of this profiler.
+    static void map_to_table(const std::shared_ptr<Timer> &timer, const uint32_t parent, AccumulatorTable &table,
+                             std::vector<uint32_t> &labels, std::vector<uint32_t> &nodes)
+    {
+        for (auto t = timer; t; t = t->next)
+        {
+            if (labels[t->name_id] == AccumulatorTable::no_node) labels[t->name_id] = table.label(t->name);
+            const auto i = table.child(parent, labels[t->name_id], t->keyed, t->key);
+            nodes[t->id] = i;
+            if (t->keyed_children)
+            {
+                std::map<int64_t, std::shared_ptr<Timer>> sorted(t->keyed_children->begin(), t->keyed_children->end());
+                for (const auto &kv: sorted)
+                    map_to_table(kv.second, i, table, labels, nodes);
+            }
+            if (t->child) map_to_table(t->child, i, table, labels, nodes);
+        }
+    }
+
+    //! Add the accumulated timings of this profiler as a new profile of table, return its index.
+    //! Timers are matched to the nodes of the table by path, looked up by parent node and name ID,
+    //! then the accumulators are read from the arena by node ID.
+    size_t export_accumulators(AccumulatorTable &table) const
+    {
+        const auto p = table.add_profile();
+        // copies of no_node, which is not defined out of the class before C++17
+        const uint32_t no_node = AccumulatorTable::no_node;
+        std::vector<uint32_t> labels(names.size(), no_node);
+        std::vector<uint32_t> nodes(hot_lines.size(), no_node);
+        map_to_table(root, AccumulatorTable::no_node, table, labels, nodes);
+        auto &c = table.profiles[p];
+        table.fit(c);
+        if (Policy::call_times) table.histogram.resize(table.size() * detail::call_time_buckets, 0);
+        for (size_t id = 0; id < nodes.size(); id++)
+        {
+            const auto i = nodes[id];
+            const auto &line = hot_lines[id];
+            if (i == AccumulatorTable::no_node || line.ncalls == 0) continue;
+            if (Policy::call_times)
+            {
+                const auto tmin = distributions.min_time(uint32_t(id));
+                c.min_time[i] = c.ncalls[i] == 0 ? tmin : std::min(c.min_time[i], tmin);
+                c.max_time[i] = std::max(c.max_time[i], distributions.max_time(uint32_t(id)));
+                const auto h = distributions.histogram(uint32_t(id));
+                for (int b = 0; b < detail::call_time_buckets; b++)
+                    table.histogram[size_t(i) * detail::call_time_buckets + b] += h[b];
+            }
+            c.ncalls[i] += line.ncalls;
+            c.cpu_time[i] += line.cpu_time_accu();
+            c.wall_time[i] += ticks_to_ms(line.accu) * 1e-3;
+        }
+        return p;
+    }
+
+    //! Write the recorded timeline in the binary format read by tools/trace_query.cpp, see TraceRecord
+    void write_trace(std::ostream &os, const int pid = 0) const
+    {
+        std::vector<std::string> labels;
+        std::map<std::string, uint32_t> label_ids;
+        std::vector<TraceRecord> records;
+        records.reserve(events.size());
+        for (const auto &e: events)
+        {
+            const auto label = e.timer->keyed ? e.timer->name + "[" + std::to_string(e.timer->key) + "]" : e.timer->name;
+            const auto it = label_ids.emplace(label, uint32_t(labels.size()));
+            if (it.second) labels.push_back(label);
+            const auto ts_ns = clock_correction.apply(e.ts_ns);
+            records.push_back({ts_ns, clock_correction.apply(e.ts_ns + e.dur_ns) - ts_ns, it.first->second, e.tid});
+        }
+        const uint32_t version = 1, nnames = uint32_t(labels.size());
+        const int32_t pid32 = pid;
+        const uint64_t nevents = records.size();
+        os.write(trace_magic, sizeof(trace_magic));
+        os.write(reinterpret_cast<const char *>(&version), sizeof(version));
+        os.write(reinterpret_cast<const char *>(&pid32), sizeof(pid32));
+        os.write(reinterpret_cast<const char *>(&nnames), sizeof(nnames));
+        for (const auto &label: labels)
+        {
+            const uint32_t len = uint32_t(label.size());
+            os.write(reinterpret_cast<const char *>(&len), sizeof(len));
+            os.write(label.data(), len);
+        }
+        os.write(reinterpret_cast<const char *>(&nevents), sizeof(nevents));
+        os.write(reinterpret_cast<const char *>(records.data()), std::streamsize(records.size() * sizeof(TraceRecord)));
+    }
+
+    //! Write the recorded timeline in Chrome trace event format, viewable in chrome://tracing or Perfetto
+    void write_chrome_trace(std::ostream &os, const int pid = 0) const
+    {
+        const auto flags = os.flags();
+        os << std::fixed << std::setprecision(3);
+        os << "{\"traceEvents\":[";
+        bool first = true;
+        for (const auto &e: events)
+        {
+            os << (first ? "\n" : ",\n");
+            first = false;
+            const auto ts_ns = clock_correction.apply(e.ts_ns);
+            os << "{\"name\":\"" << json_escape(e.timer->keyed ? e.timer->name + "[" + std::to_string(e.timer->key) + "]" : e.timer->name) << "\",\"ph\":\"X\",\"ts\":" << ts_ns * 1e-3
+               << ",\"dur\":" << (clock_correction.apply(e.ts_ns + e.dur_ns) - ts_ns) * 1e-3 << ",\"pid\":" << pid << ",\"tid\":" << e.tid;
+            if (!e.timer->note.empty()) os << ",\"args\":{\"note\":\"" << json_escape(e.timer->note) << "\"}";
+            os << "}";
+        }
+        // Mark the slowest calls with instant events
+        visit_timers(root, 0, "", [&](const Timer &t, const int, const std::string &path) {
+            if (!t.slowest_calls()) return;
+            for (const auto &c: *t.slowest_calls())
+            {
+                os << (first ? "\n" : ",\n");
+                first = false;
+                os << "{\"name\":\"slowest: " << json_escape(path) << "\",\"cat\":\"slowest\",\"ph\":\"i\",\"s\":\"t\",\"ts\":"
+                   << clock_correction.apply(c.ts_ns) * 1e-3 << ",\"pid\":" << pid << ",\"tid\":" << c.tid << ",\"args\":{\"duration_us\":"
+                   << c.duration * 1e6 << ",\"rank\":" << c.rank;
+                if (c.size >= 0.0) os << ",\"size\":" << c.size;
+                os << "}}";
+            }
+        });
+        for (const auto &f: flows)
+        {
+            os << (first ? "\n" : ",\n");
+            first = false;
+            os << "{\"name\":\"span\",\"cat\":\"span\",\"ph\":\"" << f.phase << "\",\"id\":" << f.id
+               << ",\"ts\":" << clock_correction.apply(f.ts_ns) * 1e-3 << ",\"pid\":" << pid << ",\"tid\":" << f.tid << "}";
+        }
+        os << "\n]}\n";
+        os.flags(flags);
+    }
+
+    //! Total wall time (ms) of the top-level timers
+    double total_wall_time() const noexcept
+    {
+        double total = 0.0;
+        for (auto t = root; t; t = t->next) total += t->wall_time_accu();
+        return total;
+    }
+
+    std::string get_profile_string(const int verbose = 99) noexcept
+    {
+        std::ostringstream output;
+        output << std::left;
+
+        const auto total = total_wall_time();
+        output << banner('-', 120) << "\n";
+        output << std::setw(49) << "Entry" << " " << std::setw(12) << "#calls" << " "
+            << std::setw(18) << "CPU time (s)" << " " << std::setw(18) << "Wall time (ms)" << " "
+            << std::setw(9) << "% parent" << " " << std::setw(9) << "% total" << "\n";
+        output << banner('-', 120) << "\n";
+        if (root) output << get_profile_string_of_timer(root, 0, verbose, total, total);
+        output << banner('-', 120) << "\n";
+
+        return output.str();
+    }
+
+    //! Share of the time of the timers with children covered by the children, and the n largest gaps,
+    //! i.e. where adding timers would explain the most time
+    std::string get_coverage_string(const size_t n = 10) const
+    {
+        struct Gap
+        {
+            std::string path;
+            size_t ncalls;
+            double wall, gap;
+        };
+        std::vector<Gap> gaps;
+        double parents_wall = 0.0, gaps_wall = 0.0;
+        visit_timers(root, 0, "", [&](const Timer &t, int, const std::string &path)
+        {
+            if (!t.child) return;
+            double children_cpu, children_wall;
+            children_time(t, children_cpu, children_wall);
+            // Clock granularity can make the children slightly longer than the parent
+            const auto gap = std::max(0.0, t.wall_time_accu() - children_wall);
+            parents_wall += t.wall_time_accu();
+            gaps_wall += gap;
+            gaps.push_back({path, t.ncalls(), t.wall_time_accu(), gap});
+        });
+        std::sort(gaps.begin(), gaps.end(), [](const Gap &a, const Gap &b) { return a.gap > b.gap; });
+        if (gaps.size() > n) gaps.resize(n);
+
+        const auto total = total_wall_time();
+        std::ostringstream output;
+        output << std::left << std::fixed << std::setprecision(1);
+        output << banner('-', 100) << "\n";
+        output << "Coverage: " << (total > 0.0 ? 100.0 * (1.0 - gaps_wall / total) : 0.0)
+               << "% of the total wall time, " << gaps_wall << " ms of the timers with children is outside them ("
+               << (parents_wall > 0.0 ? 100.0 * gaps_wall / parents_wall : 0.0) << "% of their time)\n";
+        output << banner('-', 100) << "\n";
+        output << std::setw(49) << "Parent" << " " << std::setw(12) << "#calls" << " " << std::setw(14)
+               << "Gap (ms)" << " " << std::setw(10) << "% parent" << " " << std::setw(10) << "% total" << "\n";
+        output << banner('-', 100) << "\n";
+        for (const auto &g: gaps)
+        {
+            output << std::setw(49) << g.path << " " << std::setw(12) << g.ncalls << " " << std::setprecision(4)
+                   << std::setw(14) << g.gap << " " << std::setw(10) << percent_string(g.gap, g.wall) << " "
+                   << std::setw(10) << percent_string(g.gap, total) << "\n";
+        }
+        output << banner('-', 100) << "\n";
+        return output.str();
     }
 
     //! Display the current profiling result
     void display(const int verbose = 99) noexcept
     {
+        flush_log();
         if (p_os) *p_os << this->get_profile_string(verbose);
     }
 
 };
 
+//! Profiler with all features, see DefaultPolicy
+using Profiler = BasicProfiler<DefaultPolicy>;
+
 }
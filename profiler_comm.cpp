@@ -0,0 +1,370 @@
+// PMPI wrappers of the point-to-point sends. See profiler_comm.h for usage.
+#include "profiler_comm.h"
+#include "profiler.h"
+
+#include <mpi.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Profiler {
+namespace comm {
+namespace {
+
+//! Messages and bytes sent to one destination within one timer
+struct Cell
+{
+    uint64_t messages;
+    uint64_t bytes;
+};
+
+//! Sparse row of the calling rank. Timer 0 is the time outside of any timer.
+struct Row
+{
+    std::mutex mutex;
+    bool enabled = true;
+    std::unordered_map<uint64_t, Cell> cells;
+    std::unordered_map<std::string, uint32_t> timer_ids;
+    std::vector<std::string> timer_names{"-"};
+    // attribute caching the ranks in MPI_COMM_WORLD of the other communicators
+    int keyval = MPI_KEYVAL_INVALID;
+};
+
+Row &row()
+{
+    static Row *r = new Row();
+    return *r;
+}
+
+int delete_ranks(MPI_Comm, int, void *attr, void *)
+{
+    delete static_cast<std::vector<int> *>(attr);
+    return MPI_SUCCESS;
+}
+
+// Rank in MPI_COMM_WORLD of rank dest of comm. For intercommunicators dest is in the remote group.
+int world_rank(MPI_Comm comm, const int dest, const int keyval)
+{
+    if (comm == MPI_COMM_WORLD) return dest;
+    void *attr = nullptr;
+    int found = 0;
+    PMPI_Comm_get_attr(comm, keyval, &attr, &found);
+    if (!found)
+    {
+        int inter = 0;
+        PMPI_Comm_test_inter(comm, &inter);
+        MPI_Group group, world_group;
+        if (inter)
+            PMPI_Comm_remote_group(comm, &group);
+        else
+            PMPI_Comm_group(comm, &group);
+        PMPI_Comm_group(MPI_COMM_WORLD, &world_group);
+        int size = 0;
+        PMPI_Group_size(group, &size);
+        std::vector<int> ranks(size);
+        for (int i = 0; i < size; i++) ranks[i] = i;
+        auto *translated = new std::vector<int>(size);
+        PMPI_Group_translate_ranks(group, size, ranks.data(), world_group, translated->data());
+        PMPI_Group_free(&group);
+        PMPI_Group_free(&world_group);
+        PMPI_Comm_set_attr(comm, keyval, translated);
+        attr = translated;
+    }
+    const auto &translated = *static_cast<std::vector<int> *>(attr);
+    return dest >= 0 && dest < int(translated.size()) ? translated[dest] : MPI_UNDEFINED;
+}
+
+void count_send(const int count, MPI_Datatype datatype, const int dest, MPI_Comm comm)
+{
+    if (dest == MPI_PROC_NULL) return;
+    auto &r = row();
+    std::lock_guard<std::mutex> guard(r.mutex);
+    if (!r.enabled) return;
+    if (r.keyval == MPI_KEYVAL_INVALID)
+        PMPI_Comm_create_keyval(MPI_COMM_NULL_COPY_FN, delete_ranks, &r.keyval, nullptr);
+    const int dst = world_rank(comm, dest, r.keyval);
+    if (dst == MPI_UNDEFINED) return;
+    int type_size = 0;
+    PMPI_Type_size(datatype, &type_size);
+
+    uint32_t timer = 0;
+    if (const auto *name = active_timer_name())
+    {
+        const auto it = r.timer_ids.emplace(*name, uint32_t(r.timer_names.size()));
+        if (it.second) r.timer_names.push_back(*name);
+        timer = it.first->second;
+    }
+    auto &cell = r.cells[(uint64_t(dst) << 32) | timer];
+    cell.messages++;
+    cell.bytes += uint64_t(count) * uint64_t(type_size);
+}
+
+// One line per cell: destination, timer, messages and bytes, tab-separated
+std::string serialize_row(Row &r)
+{
+    std::ostringstream ss;
+    std::lock_guard<std::mutex> guard(r.mutex);
+    for (const auto &kv: r.cells)
+        ss << (kv.first >> 32) << "\t" << sanitize_field(r.timer_names[kv.first & 0xffffffff]) << "\t"
+           << kv.second.messages << "\t" << kv.second.bytes << "\n";
+    return ss.str();
+}
+
+struct Entry
+{
+    int src;
+    int dst;
+    std::string timer;
+    Cell cell;
+};
+
+std::string percent(const uint64_t part, const uint64_t total)
+{
+    std::ostringstream ss;
+    ss << std::fixed << std::setprecision(1) << (total ? 100.0 * part / total : 0.0);
+    return ss.str();
+}
+
+std::string get_locality_string(const std::vector<Entry> &entries, const std::vector<std::string> &hosts)
+{
+    Cell intra{0, 0}, inter{0, 0};
+    std::map<std::string, Cell> inter_timers;
+    for (const auto &e: entries)
+    {
+        auto &c = hosts[e.src] == hosts[e.dst] ? intra : inter;
+        c.messages += e.cell.messages;
+        c.bytes += e.cell.bytes;
+        if (hosts[e.src] == hosts[e.dst]) continue;
+        auto &t = inter_timers[e.timer];
+        t.messages += e.cell.messages;
+        t.bytes += e.cell.bytes;
+    }
+    std::vector<std::string> nodes(hosts);
+    std::sort(nodes.begin(), nodes.end());
+    nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+
+    std::ostringstream output;
+    output << std::left;
+    output << "Communication locality of " << hosts.size() << " ranks on " << nodes.size() << " nodes\n";
+    output << banner('-', 100) << "\n";
+    output << std::setw(37) << "Entry" << " " << std::setw(16) << "#messages" << " " << std::setw(10) << "(%)" << " "
+           << std::setw(20) << "Bytes" << " " << std::setw(10) << "(%)" << "\n";
+    output << banner('-', 100) << "\n";
+    const Cell total{intra.messages + inter.messages, intra.bytes + inter.bytes};
+    const auto print = [&](const std::string &name, const Cell &c) {
+        output << std::setw(37) << name << " " << std::setw(16) << c.messages << " " << std::setw(10)
+               << percent(c.messages, total.messages) << " " << std::setw(20) << c.bytes << " " << std::setw(10)
+               << percent(c.bytes, total.bytes) << "\n";
+    };
+    print("intra-node", intra);
+    print("inter-node", inter);
+
+    // Timers sending the most bytes between nodes
+    std::vector<std::pair<std::string, Cell>> ranked(inter_timers.begin(), inter_timers.end());
+    std::sort(ranked.begin(), ranked.end(), [](const std::pair<std::string, Cell> &a,
+                                               const std::pair<std::string, Cell> &b) {
+        return a.second.bytes > b.second.bytes;
+    });
+    if (ranked.size() > 10) ranked.resize(10);
+    for (const auto &t: ranked) print(" inter-node in " + t.first, t.second);
+    output << banner('-', 100) << "\n";
+    return output.str();
+}
+
+// Gather the rows on rank 0, which writes the matrix and prints the locality summary
+void write_matrix()
+{
+    int rank = 0, size = 1;
+    PMPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    PMPI_Comm_size(MPI_COMM_WORLD, &size);
+    char host[MPI_MAX_PROCESSOR_NAME];
+    int len = 0;
+    PMPI_Get_processor_name(host, &len);
+    const auto local = sanitize_field(std::string(host, len)) + "\n" + serialize_row(row());
+
+    const int nlocal = int(local.size());
+    std::vector<int> counts(rank == 0 ? size : 0), displs(rank == 0 ? size : 0);
+    PMPI_Gather(&nlocal, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, MPI_COMM_WORLD);
+    std::string all;
+    if (rank == 0)
+    {
+        size_t total = 0;
+        for (int r = 0; r < size; r++)
+        {
+            displs[r] = int(total);
+            total += counts[r];
+        }
+        all.resize(total);
+    }
+    PMPI_Gatherv(local.data(), nlocal, MPI_CHAR, &all[0], counts.data(), displs.data(), MPI_CHAR, 0,
+                 MPI_COMM_WORLD);
+    if (rank != 0) return;
+
+    std::vector<std::string> hosts(size);
+    std::vector<Entry> entries;
+    std::map<std::pair<int, int>, Cell> pairs;
+    for (int r = 0; r < size; r++)
+    {
+        std::istringstream is(all.substr(displs[r], counts[r]));
+        std::getline(is, hosts[r]);
+        std::string line;
+        while (std::getline(is, line))
+        {
+            std::istringstream fields(line);
+            Entry e;
+            e.src = r;
+            std::string dst, messages, bytes;
+            if (!std::getline(fields, dst, '\t') || !std::getline(fields, e.timer, '\t') ||
+                !std::getline(fields, messages, '\t') || !std::getline(fields, bytes))
+                continue;
+            e.dst = std::stoi(dst);
+            if (e.dst < 0 || e.dst >= size) continue;
+            e.cell = {std::stoull(messages), std::stoull(bytes)};
+            auto &p = pairs[{e.src, e.dst}];
+            p.messages += e.cell.messages;
+            p.bytes += e.cell.bytes;
+            entries.push_back(std::move(e));
+        }
+    }
+
+    const char *fname = std::getenv("PROFILER_COMM_OUTPUT");
+    std::ofstream ofs(fname ? fname : "comm_matrix.txt");
+    ofs << "# Profiler communication matrix\n";
+    ofs << "# ranks\t" << size << "\n";
+    for (int r = 0; r < size; r++) ofs << "# host\t" << r << "\t" << hosts[r] << "\n";
+    ofs << "# pairs: src dst messages bytes\n";
+    for (const auto &kv: pairs)
+        ofs << kv.first.first << "\t" << kv.first.second << "\t" << kv.second.messages << "\t" << kv.second.bytes
+            << "\n";
+    ofs << "# timers: src dst timer messages bytes\n";
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+        return a.src != b.src ? a.src < b.src : a.dst != b.dst ? a.dst < b.dst : a.timer < b.timer;
+    });
+    for (const auto &e: entries)
+        ofs << e.src << "\t" << e.dst << "\t" << e.timer << "\t" << e.cell.messages << "\t" << e.cell.bytes << "\n";
+    std::cerr << get_locality_string(entries, hosts);
+}
+
+}
+
+void set_enabled(const bool enabled) noexcept
+{
+    std::lock_guard<std::mutex> guard(row().mutex);
+    row().enabled = enabled;
+}
+
+std::string get_row_string()
+{
+    auto &r = row();
+    std::vector<std::pair<uint64_t, Cell>> cells;
+    std::vector<std::string> names;
+    {
+        std::lock_guard<std::mutex> guard(r.mutex);
+        cells.assign(r.cells.begin(), r.cells.end());
+        names = r.timer_names;
+    }
+    std::sort(cells.begin(), cells.end(), [](const std::pair<uint64_t, Cell> &a,
+                                             const std::pair<uint64_t, Cell> &b) { return a.first < b.first; });
+    std::ostringstream output;
+    output << std::left;
+    output << banner('-', 100) << "\n";
+    output << std::setw(12) << "Destination" << " " << std::setw(49) << "Timer" << " " << std::setw(16)
+           << "#messages" << " " << std::setw(20) << "Bytes" << "\n";
+    output << banner('-', 100) << "\n";
+    for (const auto &c: cells)
+        output << std::setw(12) << (c.first >> 32) << " " << std::setw(49) << names[c.first & 0xffffffff] << " "
+               << std::setw(16) << c.second.messages << " " << std::setw(20) << c.second.bytes << "\n";
+    output << banner('-', 100) << "\n";
+    return output.str();
+}
+
+}
+}
+
+using namespace Profiler::comm;
+
+extern "C" {
+
+int MPI_Send(const void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm)
+{
+    count_send(count, datatype, dest, comm);
+    return PMPI_Send(buf, count, datatype, dest, tag, comm);
+}
+
+int MPI_Bsend(const void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm)
+{
+    count_send(count, datatype, dest, comm);
+    return PMPI_Bsend(buf, count, datatype, dest, tag, comm);
+}
+
+int MPI_Ssend(const void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm)
+{
+    count_send(count, datatype, dest, comm);
+    return PMPI_Ssend(buf, count, datatype, dest, tag, comm);
+}
+
+int MPI_Rsend(const void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm)
+{
+    count_send(count, datatype, dest, comm);
+    return PMPI_Rsend(buf, count, datatype, dest, tag, comm);
+}
+
+int MPI_Isend(const void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm,
+              MPI_Request *request)
+{
+    count_send(count, datatype, dest, comm);
+    return PMPI_Isend(buf, count, datatype, dest, tag, comm, request);
+}
+
+int MPI_Ibsend(const void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm,
+               MPI_Request *request)
+{
+    count_send(count, datatype, dest, comm);
+    return PMPI_Ibsend(buf, count, datatype, dest, tag, comm, request);
+}
+
+int MPI_Issend(const void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm,
+               MPI_Request *request)
+{
+    count_send(count, datatype, dest, comm);
+    return PMPI_Issend(buf, count, datatype, dest, tag, comm, request);
+}
+
+int MPI_Irsend(const void *buf, int count, MPI_Datatype datatype, int dest, int tag, MPI_Comm comm,
+               MPI_Request *request)
+{
+    count_send(count, datatype, dest, comm);
+    return PMPI_Irsend(buf, count, datatype, dest, tag, comm, request);
+}
+
+int MPI_Sendrecv(const void *sendbuf, int sendcount, MPI_Datatype sendtype, int dest, int sendtag, void *recvbuf,
+                 int recvcount, MPI_Datatype recvtype, int source, int recvtag, MPI_Comm comm, MPI_Status *status)
+{
+    count_send(sendcount, sendtype, dest, comm);
+    return PMPI_Sendrecv(sendbuf, sendcount, sendtype, dest, sendtag, recvbuf, recvcount, recvtype, source, recvtag,
+                         comm, status);
+}
+
+int MPI_Sendrecv_replace(void *buf, int count, MPI_Datatype datatype, int dest, int sendtag, int source,
+                         int recvtag, MPI_Comm comm, MPI_Status *status)
+{
+    count_send(count, datatype, dest, comm);
+    return PMPI_Sendrecv_replace(buf, count, datatype, dest, sendtag, source, recvtag, comm, status);
+}
+
+int MPI_Finalize()
+{
+    write_matrix();
+    return PMPI_Finalize();
+}
+
+}
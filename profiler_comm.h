@@ -0,0 +1,31 @@
+#pragma once
+// Rank-to-rank communication matrix collected through the PMPI profiling interface.
+//
+// Link profiler_comm.cpp into an MPI program to intercept its point-to-point sends:
+//
+//   $MPICXX -O2 -c profiler_comm.cpp
+//   $MPICXX -O2 app.cpp profiler_comm.o -o app.exe
+//
+// Every rank counts the messages and bytes it sends per destination rank of MPI_COMM_WORLD and per
+// timer running on the sending thread (see active_timer_name), in a sparse row.
+// Sends are counted when they are posted: MPI_Send, MPI_Bsend, MPI_Ssend, MPI_Rsend, their
+// non-blocking variants, MPI_Sendrecv and MPI_Sendrecv_replace. Collectives and persistent requests
+// are not counted. The traffic of the profiler itself, e.g. the ping-pongs of sync_clocks, calls the
+// PMPI entry points and is not counted either.
+//
+// At MPI_Finalize the rows are gathered on rank 0, which writes the matrix to the file named by
+// PROFILER_COMM_OUTPUT (comm_matrix.txt by default) and prints the intra-node and inter-node totals
+// to stderr. Ranks are on the same node when MPI_Get_processor_name returns the same name.
+#include <string>
+
+namespace Profiler {
+namespace comm {
+
+//! Pause or resume the counting of the calling rank, e.g. to skip the setup of the program
+void set_enabled(bool enabled) noexcept;
+
+//! Get the messages and bytes sent by the calling rank so far, per destination and timer
+std::string get_row_string();
+
+}
+}
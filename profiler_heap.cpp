@@ -0,0 +1,419 @@
+// Replacement of the global operator new and delete. See profiler_heap.h for usage.
+#include "profiler_heap.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <new>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#endif
+
+namespace Profiler {
+namespace heap {
+namespace {
+
+constexpr int64_t default_period = 512 * 1024;
+//! frames kept per sample, after the frames of the profiler
+constexpr int max_frames = 8;
+constexpr int filter_bits = 18;
+
+//! Thread-local sampling state, trivially initialized so that it can be used before main
+struct ThreadSampler
+{
+    //! bytes left before the next sample
+    int64_t countdown;
+    uint64_t rng;
+    bool started;
+    //! allocations of the profiler itself are neither sampled nor looked up
+    bool in_hook;
+};
+
+thread_local ThreadSampler sampler;
+
+struct Site
+{
+    std::vector<void *> frames;
+    std::string timer;
+    double alloc_bytes;
+    double alloc_count;
+    double live_bytes;
+    double live_count;
+};
+
+//! Sampled allocation, with the bytes and allocations it stands for
+struct Live
+{
+    size_t site;
+    double bytes;
+    double count;
+};
+
+struct Globals
+{
+    std::mutex mutex;
+    std::vector<Site> sites;
+    std::unordered_map<std::string, size_t> site_ids;
+    std::unordered_map<void *, Live> live;
+    uint64_t nsamples = 0;
+    int64_t t0_ns = 0;
+};
+
+// Allocations may come before static initialization of this file, and after its destruction
+Globals &globals()
+{
+    alignas(Globals) static char storage[sizeof(Globals)];
+    static Globals *g = ::new (storage) Globals();
+    return *g;
+}
+
+//! mean bytes between samples, -1 before reading the environment
+std::atomic<int64_t> g_period{-1};
+
+//! Number of live samples per hash of their address, so that most deletions skip the lock
+std::atomic<uint32_t> g_filter[1 << filter_bits];
+
+inline size_t filter_index(const void *p) noexcept
+{
+    return size_t((reinterpret_cast<uintptr_t>(p) >> 4) * 0x9E3779B97F4A7C15ULL >> (64 - filter_bits));
+}
+
+int64_t now_ns() noexcept
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int64_t sample_period() noexcept
+{
+    auto period = g_period.load(std::memory_order_relaxed);
+    if (period < 0)
+    {
+        const char *s = std::getenv("PROFILER_HEAP_SAMPLE");
+        period = s ? std::max<int64_t>(0, std::atoll(s)) : default_period;
+        int64_t unset = -1;
+        g_period.compare_exchange_strong(unset, period);
+        period = g_period.load(std::memory_order_relaxed);
+    }
+    return period;
+}
+
+// Exponential interval of mean period bytes
+int64_t next_interval(ThreadSampler &t, const int64_t period) noexcept
+{
+    // Check again later if sampling is enabled
+    if (period <= 0) return int64_t(64) << 20;
+    t.rng ^= t.rng >> 12;
+    t.rng ^= t.rng << 25;
+    t.rng ^= t.rng >> 27;
+    const double u = double((t.rng * 0x2545F4914F6CDD1DULL) >> 11) * 0x1.0p-53;
+    return int64_t(-std::log(1.0 - u) * double(period)) + 1;
+}
+
+std::string site_key(const void *const *frames, const int nframes, const std::string &timer)
+{
+    std::string key(reinterpret_cast<const char *>(frames), nframes * sizeof(void *));
+    key += '\0';
+    key += timer;
+    return key;
+}
+
+__attribute__((noinline)) void sample(void *p, const size_t size)
+{
+    auto &t = sampler;
+    if (!t.started)
+    {
+        t.started = true;
+        t.rng = reinterpret_cast<uintptr_t>(&t) ^ uint64_t(now_ns()) ^ 0x9E3779B97F4A7C15ULL;
+        if (t.rng == 0) t.rng = 1;
+    }
+    const auto period = sample_period();
+    t.countdown = next_interval(t, period);
+    if (t.in_hook || period <= 0) return;
+    t.in_hook = true;
+
+    // Skip the frames of sample and operator new
+    void *frames[max_frames + 2];
+    int nframes = 0;
+#if defined(__linux__) || defined(__APPLE__)
+    nframes = std::max(0, backtrace(frames, max_frames + 2) - 2);
+#endif
+    const auto timer = active_timer_path();
+    // Probability that an allocation of size is sampled, so that each sample stands for size / probability bytes
+    const double probability = 1.0 - std::exp(-double(size) / double(period));
+    const Live l{0, double(size) / probability, 1.0 / probability};
+
+    auto &g = globals();
+    {
+        std::lock_guard<std::mutex> guard(g.mutex);
+        if (g.t0_ns == 0) g.t0_ns = now_ns();
+        const auto it = g.site_ids.emplace(site_key(frames + 2, nframes, timer), g.sites.size());
+        if (it.second) g.sites.push_back({std::vector<void *>(frames + 2, frames + 2 + nframes), timer, 0, 0, 0, 0});
+        auto &site = g.sites[it.first->second];
+        site.alloc_bytes += l.bytes;
+        site.alloc_count += l.count;
+        site.live_bytes += l.bytes;
+        site.live_count += l.count;
+        g.live[p] = {it.first->second, l.bytes, l.count};
+        g.nsamples++;
+        g_filter[filter_index(p)].fetch_add(1, std::memory_order_relaxed);
+    }
+    t.in_hook = false;
+}
+
+void unsample(void *p)
+{
+    auto &t = sampler;
+    t.in_hook = true;
+    auto &g = globals();
+    {
+        std::lock_guard<std::mutex> guard(g.mutex);
+        const auto it = g.live.find(p);
+        if (it != g.live.end())
+        {
+            auto &site = g.sites[it->second.site];
+            site.live_bytes -= it->second.bytes;
+            site.live_count -= it->second.count;
+            g.live.erase(it);
+            g_filter[filter_index(p)].fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+    t.in_hook = false;
+}
+
+inline void *record(void *p, const size_t size)
+{
+    auto &t = sampler;
+    t.countdown -= int64_t(size);
+    if (t.countdown < 0) sample(p, size);
+    return p;
+}
+
+inline void release(void *p) noexcept
+{
+    if (p && !sampler.in_hook && g_filter[filter_index(p)].load(std::memory_order_relaxed) != 0) unsample(p);
+    std::free(p);
+}
+
+void *allocate(size_t size)
+{
+    if (size == 0) size = 1;
+    void *p;
+    while (!(p = std::malloc(size)))
+    {
+        const auto handler = std::get_new_handler();
+        if (!handler) throw std::bad_alloc();
+        handler();
+    }
+    return record(p, size);
+}
+
+void *allocate_aligned(size_t size, const size_t alignment)
+{
+    if (size == 0) size = 1;
+    void *p;
+    while (posix_memalign(&p, std::max(alignment, sizeof(void *)), size) != 0)
+    {
+        const auto handler = std::get_new_handler();
+        if (!handler) throw std::bad_alloc();
+        handler();
+    }
+    return record(p, size);
+}
+
+std::string symbolize(void *fn)
+{
+    std::ostringstream ss;
+#if defined(__linux__) || defined(__APPLE__)
+    Dl_info info;
+    if (dladdr(fn, &info) && info.dli_sname)
+    {
+        int status = 0;
+        char *demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+        std::string name = status == 0 && demangled ? demangled : info.dli_sname;
+        std::free(demangled);
+        // the arguments make the names of templates unreadable
+        const auto paren = name.find('(');
+        return paren == std::string::npos ? name : name.substr(0, paren);
+    }
+    if (dladdr(fn, &info) && info.dli_fname)
+    {
+        const char *base = std::strrchr(info.dli_fname, '/');
+        ss << (base ? base + 1 : info.dli_fname) << "+0x" << std::hex
+           << (reinterpret_cast<uintptr_t>(fn) - reinterpret_cast<uintptr_t>(info.dli_fbase));
+        return ss.str();
+    }
+#endif
+    ss << fn;
+    return ss.str();
+}
+
+struct ReportAtExit
+{
+    ~ReportAtExit()
+    {
+        const char *fname = std::getenv("PROFILER_HEAP_OUTPUT");
+        if (!fname) return;
+        std::ofstream ofs(fname);
+        ofs << get_profile_string();
+    }
+} g_report_at_exit;
+
+}
+
+void set_sample_period(const size_t bytes) noexcept
+{
+    g_period.store(int64_t(bytes), std::memory_order_relaxed);
+}
+
+double live_bytes() noexcept
+{
+    auto &g = globals();
+    std::lock_guard<std::mutex> guard(g.mutex);
+    double bytes = 0.0;
+    for (const auto &s: g.sites) bytes += s.live_bytes;
+    return bytes;
+}
+
+std::map<std::string, double> live_bytes_by_timer()
+{
+    const bool in_hook = sampler.in_hook;
+    sampler.in_hook = true;
+    std::map<std::string, double> timers;
+    {
+        auto &g = globals();
+        std::lock_guard<std::mutex> guard(g.mutex);
+        for (const auto &s: g.sites) timers[s.timer.empty() ? "-" : s.timer] += s.live_bytes;
+    }
+    sampler.in_hook = in_hook;
+    return timers;
+}
+
+std::string get_profile_string(const size_t nsites)
+{
+    const bool in_hook = sampler.in_hook;
+    sampler.in_hook = true;
+    std::vector<Site> sites;
+    uint64_t nsamples;
+    int64_t t0_ns;
+    {
+        auto &g = globals();
+        std::lock_guard<std::mutex> guard(g.mutex);
+        sites = g.sites;
+        nsamples = g.nsamples;
+        t0_ns = g.t0_ns;
+    }
+    const double elapsed = t0_ns ? std::max(1e-9, (now_ns() - t0_ns) * 1e-9) : 1.0;
+
+    double live = 0.0, allocated = 0.0;
+    std::map<std::string, Site> timers;
+    for (const auto &s: sites)
+    {
+        live += s.live_bytes;
+        allocated += s.alloc_bytes;
+        auto &t = timers[s.timer.empty() ? "-" : s.timer];
+        t.live_bytes += s.live_bytes;
+        t.alloc_bytes += s.alloc_bytes;
+        t.alloc_count += s.alloc_count;
+    }
+    std::sort(sites.begin(), sites.end(), [](const Site &a, const Site &b) {
+        return a.live_bytes != b.live_bytes ? a.live_bytes > b.live_bytes : a.alloc_bytes > b.alloc_bytes;
+    });
+    if (sites.size() > nsites) sites.resize(nsites);
+
+    const auto mb = [](const double bytes) {
+        std::ostringstream ss;
+        ss << std::fixed << std::setprecision(2) << bytes / (1 << 20);
+        return ss.str();
+    };
+    std::ostringstream output;
+    output << std::left;
+    output << "Heap profile: " << mb(live) << " MB live, " << mb(allocated) << " MB allocated in " << std::fixed
+           << std::setprecision(1) << elapsed << " s, estimated from " << nsamples << " samples\n";
+    output << banner('-', 100) << "\n";
+    output << std::setw(12) << "Live (MB)" << " " << std::setw(14) << "Alloc (MB)" << " " << std::setw(12)
+           << "Rate (MB/s)" << " " << std::setw(29) << "Timer" << " " << "Call site" << "\n";
+    output << banner('-', 100) << "\n";
+    for (const auto &s: sites)
+    {
+        std::string where;
+        for (size_t i = 0; i < s.frames.size() && i < 3; i++) where += (i ? " < " : "") + symbolize(s.frames[i]);
+        output << std::setw(12) << mb(s.live_bytes) << " " << std::setw(14) << mb(s.alloc_bytes) << " "
+               << std::setw(12) << mb(s.alloc_bytes / elapsed) << " " << std::setw(29)
+               << (s.timer.empty() ? "-" : s.timer) << " " << where << "\n";
+    }
+    output << banner('-', 100) << "\n";
+    output << std::setw(49) << "Timer" << " " << std::setw(12) << "Live (MB)" << " " << std::setw(14)
+           << "Alloc (MB)" << " " << std::setw(12) << "Rate (MB/s)" << " " << std::setw(10) << "#allocs" << "\n";
+    output << banner('-', 100) << "\n";
+    for (const auto &kv: timers)
+        output << std::setw(49) << kv.first << " " << std::setw(12) << mb(kv.second.live_bytes) << " "
+               << std::setw(14) << mb(kv.second.alloc_bytes) << " " << std::setw(12)
+               << mb(kv.second.alloc_bytes / elapsed) << " " << std::setw(10) << std::setprecision(0)
+               << kv.second.alloc_count << "\n";
+    output << banner('-', 100) << "\n";
+    const auto s = output.str();
+    sampler.in_hook = in_hook;
+    return s;
+}
+
+}
+}
+
+using namespace Profiler::heap;
+
+void *operator new(std::size_t size) { return allocate(size); }
+void *operator new[](std::size_t size) { return allocate(size); }
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    try { return allocate(size); } catch (...) { return nullptr; }
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+    try { return allocate(size); } catch (...) { return nullptr; }
+}
+
+void operator delete(void *p) noexcept { release(p); }
+void operator delete[](void *p) noexcept { release(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { release(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { release(p); }
+void operator delete(void *p, std::size_t) noexcept { release(p); }
+void operator delete[](void *p, std::size_t) noexcept { release(p); }
+
+#if __cpp_aligned_new
+void *operator new(std::size_t size, std::align_val_t al) { return allocate_aligned(size, size_t(al)); }
+void *operator new[](std::size_t size, std::align_val_t al) { return allocate_aligned(size, size_t(al)); }
+
+void *operator new(std::size_t size, std::align_val_t al, const std::nothrow_t &) noexcept
+{
+    try { return allocate_aligned(size, size_t(al)); } catch (...) { return nullptr; }
+}
+
+void *operator new[](std::size_t size, std::align_val_t al, const std::nothrow_t &) noexcept
+{
+    try { return allocate_aligned(size, size_t(al)); } catch (...) { return nullptr; }
+}
+
+void operator delete(void *p, std::align_val_t) noexcept { release(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { release(p); }
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept { release(p); }
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept { release(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept { release(p); }
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept { release(p); }
+#endif
@@ -0,0 +1,41 @@
+#pragma once
+// Sampling heap profiler.
+//
+// Link profiler_heap.cpp into the program to replace the global operator new and delete:
+//
+//   $CXX -O2 -c profiler_heap.cpp
+//   $CXX -O2 -rdynamic app.cpp profiler_heap.o -ldl -o app.exe
+//
+// On average one allocation per sample period of allocated bytes (512 KiB by default) is sampled,
+// with exponentially distributed intervals so that every byte has the same chance to be sampled.
+// A sampled allocation records a short backtrace and the path of the timer running on the thread
+// (see active_timer_path), and stays in the live set until it is deleted. Other allocations only
+// cost a thread-local subtraction, and their deletion a table lookup.
+// Each sample stands for the bytes allocated since the previous one, which gives unbiased estimates
+// of the live bytes and the allocation rate per call site and per timer.
+// Memory allocated with malloc directly is not seen.
+//
+// Environment variables read at the first allocation:
+//   PROFILER_HEAP_SAMPLE    mean number of bytes between samples, 0 to disable sampling
+//   PROFILER_HEAP_OUTPUT    file where the report is written at exit, no report without it
+#include <cstddef>
+#include <map>
+#include <string>
+
+namespace Profiler {
+namespace heap {
+
+//! Set the mean number of bytes between samples, 0 disables sampling
+void set_sample_period(size_t bytes) noexcept;
+
+//! Estimated bytes of the live allocations
+double live_bytes() noexcept;
+
+//! Estimated bytes of the live allocations by path of the timer running at their allocation, "-" outside timers
+std::map<std::string, double> live_bytes_by_timer();
+
+//! Get the nsites call sites with the most live bytes, and the live bytes and allocation rate per timer
+std::string get_profile_string(size_t nsites = 20);
+
+}
+}
@@ -0,0 +1,388 @@
+#pragma once
+// Standalone HTML report of one or many profiles, e.g. of all the ranks of a run.
+// The page embeds the data in columnar arrays and draws only the visible rows of the tree,
+// so that it stays responsive with 100k nodes, without any server or external script.
+#include "profiler.h"
+
+#include <cmath>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace Profiler {
+
+namespace detail
+{
+// Page before the data. Split in several literals, some compilers limit the length of one literal.
+static const char *const html_report_head[] = {R"HTML(<!DOCTYPE html>
+<html><head><meta charset="utf-8"><title>Profile</title>
+<style>
+body{font:13px sans-serif;margin:0;display:flex;flex-direction:column;height:100vh}
+#bar{padding:6px;border-bottom:1px solid #ccc;display:flex;gap:8px;align-items:center}
+#main{flex:1;display:flex;min-height:0}
+#left{flex:3;display:flex;flex-direction:column;min-width:0}
+#head,#tree{font-family:monospace;white-space:nowrap}
+#head{font-weight:bold;padding:2px 0;border-bottom:1px solid #ccc;overflow:hidden}
+#tree{flex:1;overflow:auto;position:relative}
+#flame{height:260px;width:100%;border-top:1px solid #ccc;display:block}
+#side{flex:1;border-left:1px solid #ccc;padding:6px;overflow:auto;min-width:280px}
+.row{position:absolute;left:0;right:0;height:18px;line-height:18px;cursor:pointer}
+.row:hover{background:#eef}
+.sel{background:#cde}
+.hit{color:#c00;font-weight:bold}
+.tg{display:inline-block;width:14px}
+.num{display:inline-block;width:92px;text-align:right}
+.name{display:inline-block;width:480px;overflow:hidden;text-overflow:ellipsis;vertical-align:top}
+.pct{display:inline-block;width:120px}
+.pct i{display:inline-block;height:9px;background:#e8a}
+#info td{padding:1px 6px}
+</style>)HTML", R"HTML(</head><body>
+<div id="bar"><b id="title"></b>
+Sort <select id="sort"><option value="incl">inclusive</option><option value="self">self</option>
+<option value="calls">calls</option><option value="name">name</option></select>
+<input id="search" placeholder="search, Enter" size="30">
+<button id="expand">expand all</button><button id="collapse">collapse all</button>
+<span id="status"></span></div>
+<div id="main"><div id="left"><div id="head"></div><div id="tree"><div id="rows"></div></div>
+<canvas id="flame"></canvas></div>
+<div id="side"><div id="info">Click a node</div><canvas id="dist" width="300" height="220"></canvas></div></div>
+<script>
+const D = )HTML"};
+
+// Script after the data
+static const char *const html_report_tail[] = {R"HTML(;
+(function () {
+"use strict";
+const N = D.parent.length, P = D.nprofiles, ROW = 18;
+const $ = id => document.getElementById(id);
+const esc = s => s.replace(/&/g, "&amp;").replace(/</g, "&lt;");
+const fmt = v => v >= 100 ? v.toFixed(1) : v >= 1 ? v.toFixed(3) : v.toPrecision(3);
+
+// Children in compressed rows, roots have parent -1
+const nkids = new Int32Array(N + 1), roots = [];
+for (let i = 0; i < N; i++) D.parent[i] < 0 ? roots.push(i) : nkids[D.parent[i]]++;
+const first = new Int32Array(N + 1);
+for (let i = 0; i < N; i++) first[i + 1] = first[i] + nkids[i];
+const kids = new Int32Array(first[N]), fill = first.slice(0, N);
+for (let i = 0; i < N; i++) if (D.parent[i] >= 0) kids[fill[D.parent[i]]++] = i;
+
+const incl = D.wall, self = Float64Array.from(incl), depth = new Int32Array(N);
+for (let i = 0; i < N; i++) if (D.parent[i] >= 0) self[D.parent[i]] -= incl[i];
+for (let i = 0; i < N; i++) if (self[i] < 0) self[i] = 0;
+let total = 0;
+for (const r of roots) total += incl[r];
+{
+    const stack = roots.slice();
+    while (stack.length) {
+        const i = stack.pop();
+        for (let k = first[i]; k < first[i + 1]; k++) { depth[kids[k]] = depth[i] + 1; stack.push(kids[k]); }
+    }
+}
+const name = i => D.names[D.name[i]];
+function path(i) { const p = []; for (; i >= 0; i = D.parent[i]) p.push(name(i)); return p.reverse().join("/"); }
+
+// Sort the children of every node, and the roots
+const keys = { incl: i => -incl[i], self: i => -self[i], calls: i => -D.calls[i] };
+function sortKids(by) {
+    const cmp = by === "name" ? (a, b) => name(a) < name(b) ? -1 : name(a) > name(b) ? 1 : 0
+                              : (a, b) => keys[by](a) - keys[by](b);
+    for (let i = 0; i < N; i++) if (first[i + 1] - first[i] > 1) kids.subarray(first[i], first[i + 1]).sort(cmp);
+    roots.sort(cmp);
+}
+
+// Visible rows: expanded subtrees, restricted to the hits of the search and their ancestors
+const open = new Uint8Array(N), keep = new Uint8Array(N), hit = new Uint8Array(N);
+let filtered = false, rows = new Int32Array(0), selected = -1;
+for (const r of roots) open[r] = 1;
+function buildRows() {
+    const out = [], stack = roots.slice().reverse();
+    while (stack.length) {
+        const i = stack.pop();
+        if (filtered && !keep[i]) continue;
+        out.push(i);
+        if (open[i]) for (let k = first[i + 1] - 1; k >= first[i]; k--) stack.push(kids[k]);
+    }
+    rows = Int32Array.from(out);
+    $("rows").style.height = rows.length * ROW + "px";
+    render();
+}
+
+const multi = P > 1;
+$("title").textContent = D.title + (multi ? " (mean over " + P + " profiles)" : "");
+document.title = D.title;
+$("head").innerHTML = '<span class="tg"></span><span class="name">Entry</span><span class="num">#calls</span>' +
+    '<span class="num">Incl (s)</span><span class="num">Self (s)</span><span class="pct">&nbsp;(%)</span>' +
+    (multi ? '<span class="num">Max (s)</span><span class="num">Max/mean</span>' : "");
+function render() {
+    const tree = $("tree"), start = Math.max(0, Math.floor(tree.scrollTop / ROW) - 5);
+    const end = Math.min(rows.length, start + Math.ceil(tree.clientHeight / ROW) + 10);
+    let html = "";
+    for (let r = start; r < end; r++) {
+        const i = rows[r], n = first[i + 1] - first[i], pct = total > 0 ? 100 * incl[i] / total : 0;
+        html += '<div class="row' + (i === selected ? " sel" : "") + '" data-i="' + i + '" style="top:' + r * ROW +
+            'px"><span class="tg">' + (n ? (open[i] ? "&#9662;" : "&#9656;") : "") + '</span><span class="name' +
+            (hit[i] ? " hit" : "") + '" style="padding-left:' + depth[i] * 12 + 'px">' + esc(name(i)) +
+            '</span><span class="num">' + D.calls[i] + '</span><span class="num">' + fmt(incl[i]) +
+            '</span><span class="num">' + fmt(self[i]) + '</span><span class="pct">&nbsp;<i style="width:' +
+            Math.round(pct * 0.7) + 'px"></i> ' + pct.toFixed(1) + '</span>' +
+            (multi ? '<span class="num">' + fmt(D.q[4 * i + 3]) + '</span><span class="num">' +
+                (D.mean[i] > 0 ? (D.q[4 * i + 3] / D.mean[i]).toFixed(2) : "-") + '</span>' : "") + '</div>';
+    }
+    $("rows").innerHTML = html;
+}
+
+function toggle(i, on) { open[i] = on; }
+function select(i) {
+    selected = i;
+    for (let p = D.parent[i]; p >= 0; p = D.parent[p]) open[p] = 1;
+    buildRows();
+    const r = rows.indexOf(i), tree = $("tree");
+    if (r >= 0 && (r * ROW < tree.scrollTop || r * ROW > tree.scrollTop + tree.clientHeight - ROW))
+        tree.scrollTop = r * ROW - tree.clientHeight / 2;
+    showInfo(i);
+    drawFlame();
+}
+
+$("tree").addEventListener("scroll", render);
+$("rows").addEventListener("click", e => {
+    const row = e.target.closest(".row");
+    if (!row) return;
+    const i = +row.dataset.i;
+    if (e.target.classList.contains("tg")) { open[i] ^= 1; buildRows(); return; }
+    select(i);
+});
+$("rows").addEventListener("dblclick", e => {
+    const row = e.target.closest(".row");
+    if (row) { zoom = +row.dataset.i; drawFlame(); }
+});
+$("sort").addEventListener("change", e => { sortKids(e.target.value); buildRows(); drawFlame(); });
+$("expand").addEventListener("click", () => { open.fill(1); buildRows(); });
+$("collapse").addEventListener("click", () => { open.fill(0); buildRows(); });
+$("search").addEventListener("keydown", e => {
+    if (e.key !== "Enter") return;
+    const term = e.target.value.toLowerCase();
+    hit.fill(0); keep.fill(0);
+    filtered = term.length > 0;
+    let nhits = 0;
+    if (filtered) {
+        // Match the names once, not every node
+        const match = D.names.map(s => s.toLowerCase().includes(term));
+        for (let i = 0; i < N; i++) {
+            if (!match[D.name[i]]) continue;
+            hit[i] = 1; nhits++;
+            for (let p = i; p >= 0 && !keep[p]; p = D.parent[p]) { keep[p] = 1; if (p !== i) open[p] = 1; }
+        }
+    }
+    $("status").textContent = filtered ? nhits + " matches" : "";
+    buildRows();
+});
+
+)HTML", R"HTML(// Icicle of the zoomed node, or of all roots, with widths proportional to the inclusive time
+let zoom = -1, rects = [];
+const flame = $("flame"), fctx = flame.getContext("2d"), FH = 16;
+function hue(s) { let h = 0; for (let k = 0; k < s.length; k++) h = (h * 31 + s.charCodeAt(k)) | 0; return Math.abs(h) % 360; }
+function drawFlame() {
+    const W = flame.clientWidth, H = flame.clientHeight, dpr = window.devicePixelRatio || 1;
+    flame.width = W * dpr; flame.height = H * dpr;
+    fctx.setTransform(dpr, 0, 0, dpr, 0, 0);
+    fctx.clearRect(0, 0, W, H);
+    fctx.font = "11px sans-serif"; fctx.textBaseline = "middle";
+    rects = [];
+    const top = zoom >= 0 ? [zoom] : roots, width = zoom >= 0 ? incl[zoom] : total;
+    if (width <= 0) return;
+    const maxLevel = Math.floor(H / FH), stack = [];
+    let x = 0;
+    for (const r of top) { stack.push([r, x, W * incl[r] / width, 0]); x += W * incl[r] / width; }
+    while (stack.length) {
+        const [i, x0, w, level] = stack.pop();
+        if (w < 0.5 || level >= maxLevel) continue;
+        const label = name(i), y = level * FH;
+        fctx.fillStyle = i === selected ? "#f80" : "hsl(" + hue(label) + ",60%," + (hit[i] ? "55%" : "75%") + ")";
+        fctx.fillRect(x0, y, Math.max(w - 1, 0.5), FH - 1);
+        if (w > 30) {
+            fctx.fillStyle = "#000";
+            fctx.save(); fctx.beginPath(); fctx.rect(x0, y, w - 2, FH); fctx.clip();
+            fctx.fillText(label + " " + fmt(incl[i]), x0 + 2, y + FH / 2); fctx.restore();
+        }
+        rects.push([x0, y, w, i]);
+        let cx = x0;
+        for (let k = first[i]; k < first[i + 1]; k++) {
+            const c = kids[k], cw = incl[i] > 0 ? w * incl[c] / incl[i] : 0;
+            stack.push([c, cx, cw, level + 1]);
+            cx += cw;
+        }
+    }
+}
+flame.addEventListener("click", e => {
+    const b = flame.getBoundingClientRect(), x = e.clientX - b.left, y = e.clientY - b.top;
+    for (const [x0, y0, w, i] of rects) {
+        if (x < x0 || x >= x0 + w || y < y0 || y >= y0 + FH) continue;
+        // The top bar of a zoomed view zooms out
+        zoom = i === zoom ? D.parent[i] : i;
+        select(i);
+        return;
+    }
+});
+window.addEventListener("resize", () => { render(); drawFlame(); });
+
+// Path, times, and distribution of the inclusive time over the profiles
+function showInfo(i) {
+    let html = "<b>" + esc(path(i)) + "</b><table>" +
+        "<tr><td>#calls</td><td>" + D.calls[i] + "</td></tr>" +
+        "<tr><td>Inclusive (s)</td><td>" + fmt(incl[i]) + "</td></tr>" +
+        "<tr><td>Self (s)</td><td>" + fmt(self[i]) + "</td></tr>" +
+        "<tr><td>CPU (s)</td><td>" + fmt(D.cpu[i]) + "</td></tr>";
+    if (multi) {
+        html += "<tr><td>Min / P50 / P90 / Max (s)</td><td>" + [0, 1, 2, 3].map(k => fmt(D.q[4 * i + k])).join(" / ") +
+            "</td></tr>";
+        if (D.values) {
+            let arg = 0;
+            for (let p = 1; p < P; p++) if (D.values[i * P + p] > D.values[i * P + arg]) arg = p;
+            html += "<tr><td>Slowest</td><td>" + esc(D.profiles[arg] || "profile " + arg) + "</td></tr>";
+        }
+    }
+    $("info").innerHTML = html + "</table>";
+    drawDist(i);
+}
+function drawDist(i) {
+    const c = $("dist"), ctx = c.getContext("2d"), W = c.width, H = c.height;
+    ctx.clearRect(0, 0, W, H);
+    if (!multi) return;
+    ctx.font = "11px sans-serif";
+    const max = D.q[4 * i + 3] || 1;
+    if (D.values) {
+        // One bar per profile in profile order, the mean as a line
+        const bw = W / P;
+        ctx.fillStyle = "#58a";
+        for (let p = 0; p < P; p++) {
+            const h = (H - 20) * D.values[i * P + p] / max;
+            ctx.fillRect(p * bw, H - 12 - h, Math.max(bw - (bw > 3 ? 1 : 0), 0.5), h);
+        }
+        const y = H - 12 - (H - 20) * D.mean[i] / max;
+        ctx.strokeStyle = "#c00"; ctx.beginPath(); ctx.moveTo(0, y); ctx.lineTo(W, y); ctx.stroke();
+        ctx.fillStyle = "#000";
+        ctx.fillText("profiles 0 to " + (P - 1) + ", red: mean", 2, H - 2);
+    } else {
+        // Box of the quantiles only, the values of every profile were not embedded
+        const xs = [0, 1, 2, 3].map(k => 10 + (W - 20) * D.q[4 * i + k] / max);
+        ctx.strokeStyle = "#58a";
+        ctx.beginPath(); ctx.moveTo(xs[0], H / 2); ctx.lineTo(xs[3], H / 2); ctx.stroke();
+        ctx.strokeRect(xs[1], H / 2 - 20, xs[2] - xs[1], 40);
+        ctx.fillStyle = "#000";
+        ctx.fillText("min, P50, P90, max over " + P + " profiles", 10, H - 4);
+    }
+}
+
+sortKids("incl");
+buildRows();
+drawFlame();
+})();
+</script></body></html>
+)HTML"};
+
+// JSON string that cannot close the script element
+inline std::string html_json_string(const std::string &s)
+{
+    std::string out = "\"";
+    for (const char c: json_escape(s))
+    {
+        if (c == '<')
+            out += "\\u003c";
+        else
+            out += c;
+    }
+    return out + "\"";
+}
+
+// Array of numbers with 4 significant digits, which is enough for the report and keeps the file small
+template <typename F>
+void write_json_numbers(std::ostream &os, const size_t n, F &&value)
+{
+    os << "[";
+    for (size_t i = 0; i < n; i++)
+    {
+        const double v = value(i);
+        os << (i ? "," : "") << (std::isfinite(v) ? v : 0.0);
+    }
+    os << "]";
+}
+}
+
+//! Write the profiles of table as one standalone HTML page, with a collapsible tree sorted by inclusive or
+//! self time, an icicle view, a search, and the distribution of each node over the profiles.
+//! Times are means over the profiles. The time of each node in each profile is embedded up to max_values
+//! values in total, otherwise only its quantiles. profile_names label the profiles, e.g. "rank 3".
+inline void write_html_report(std::ostream &os, const AccumulatorTable &table, const std::string &title = "Profile",
+                              const std::vector<std::string> &profile_names = {},
+                              const size_t max_values = 4000000)
+{
+    const size_t n = table.size(), np = table.nprofiles();
+    const auto reduction = table.reduce();
+
+    // Names are interned, a tree of 100k nodes has far fewer distinct names
+    std::unordered_map<std::string, size_t> path_ids, name_ids;
+    std::vector<std::string> names;
+    std::vector<size_t> name(n);
+    std::vector<long> parent(n, -1);
+    for (size_t i = 0; i < n; i++) path_ids.emplace(table.paths[i], i);
+    for (size_t i = 0; i < n; i++)
+    {
+        const auto &path = table.paths[i];
+        const auto slash = table.depths[i] > 0 ? path.rfind('/') : std::string::npos;
+        if (slash != std::string::npos)
+        {
+            const auto it = path_ids.find(path.substr(0, slash));
+            if (it != path_ids.end()) parent[i] = long(it->second);
+        }
+        const auto leaf = slash == std::string::npos ? path : path.substr(slash + 1);
+        const auto it = name_ids.emplace(leaf, names.size());
+        if (it.second) names.push_back(leaf);
+        name[i] = it.first->second;
+    }
+
+    const auto flags = os.flags();
+    const auto precision = os.precision();
+    os << std::defaultfloat << std::setprecision(4);
+    for (const auto *part: detail::html_report_head) os << part;
+    os << "{\"title\":" << detail::html_json_string(title) << ",\"nprofiles\":" << std::max<size_t>(np, 1);
+    os << ",\"profiles\":[";
+    for (size_t p = 0; p < profile_names.size(); p++) os << (p ? "," : "") << detail::html_json_string(profile_names[p]);
+    os << "],\"names\":[";
+    for (size_t k = 0; k < names.size(); k++) os << (k ? "," : "") << detail::html_json_string(names[k]);
+    os << "],\n\"name\":[";
+    for (size_t i = 0; i < n; i++) os << (i ? "," : "") << name[i];
+    os << "],\n\"parent\":[";
+    for (size_t i = 0; i < n; i++) os << (i ? "," : "") << parent[i];
+    os << "],\n\"calls\":[";
+    for (size_t i = 0; i < n; i++) os << (i ? "," : "") << reduction.ncalls[i];
+    os << "],\n\"wall\":";
+    detail::write_json_numbers(os, n, [&](size_t i) { return reduction.wall_sum[i] / std::max<size_t>(np, 1); });
+    os << ",\n\"cpu\":";
+    detail::write_json_numbers(os, n, [&](size_t i) { return reduction.cpu_sum[i] / std::max<size_t>(np, 1); });
+    os << ",\n\"mean\":";
+    detail::write_json_numbers(os, n, [&](size_t i) { return reduction.wall_mean[i]; });
+    os << ",\n\"q\":";
+    detail::write_json_numbers(os, 4 * n, [&](size_t k) {
+        const auto i = k / 4;
+        const double q[] = {reduction.wall_min[i], reduction.wall_p50[i], reduction.wall_p90[i],
+                            reduction.wall_max[i]};
+        return q[k % 4];
+    });
+    os << ",\n\"values\":";
+    if (np > 1 && n * np <= max_values)
+    {
+        // node-major, the profiles of a node are contiguous for the distribution view
+        detail::write_json_numbers(os, n * np, [&](size_t k) {
+            const auto &wall = table.profiles[k % np].wall_time;
+            return k / np < wall.size() ? wall[k / np] : 0.0;
+        });
+    }
+    else
+        os << "null";
+    os << "}";
+    for (const auto *part: detail::html_report_tail) os << part;
+    os.flags(flags);
+    os.precision(precision);
+}
+
+}
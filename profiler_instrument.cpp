@@ -0,0 +1,429 @@
+// Hooks of -finstrument-functions. Do NOT compile this file with -finstrument-functions.
+// See profiler_instrument.h for usage.
+#include "profiler_instrument.h"
+#include "profiler.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <cxxabi.h>
+#include <dlfcn.h>
+#endif
+
+#define PROFILER_NO_INSTRUMENT __attribute__((no_instrument_function))
+
+namespace Profiler {
+namespace instrument {
+namespace {
+
+//! Number of calls of a function before its mean duration is compared to the cutoff
+constexpr uint64_t probe_calls = 128;
+
+struct Range
+{
+    uintptr_t lo;
+    uintptr_t hi;
+};
+
+//! Node of the per-thread call tree
+struct Node
+{
+    const void *fn;
+    Node *parent;
+    Node *child;
+    Node *next;
+    uint64_t ncalls;
+    int64_t ns_accu;
+    int64_t ns_start;
+};
+
+//! Per-function decision cache of a thread
+struct FuncState
+{
+    const void *fn;
+    unsigned generation;
+    bool recorded;
+    uint64_t ncalls;
+    int64_t ns_accu;
+};
+
+struct ThreadState
+{
+    unsigned index;
+    Node root;
+    Node *current;
+    // nullptr marks a call which is not recorded
+    std::vector<Node *> stack;
+    std::vector<FuncState> funcs;
+    size_t nfuncs;
+    bool in_hook;
+};
+
+// Hooks may run before static initialization of this file, so the globals are never destroyed
+struct Globals
+{
+    std::mutex mutex;
+    std::vector<Range> include;
+    std::vector<Range> exclude;
+    std::vector<ThreadState *> threads;
+    std::atomic<unsigned> generation{1};
+    std::atomic<int64_t> min_ns{0};
+    std::once_flag env_once;
+};
+
+PROFILER_NO_INSTRUMENT Globals &globals()
+{
+    static Globals *g = new Globals();
+    return *g;
+}
+
+PROFILER_NO_INSTRUMENT int64_t now_ns() noexcept
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+PROFILER_NO_INSTRUMENT void parse_ranges(const char *env, std::vector<Range> &ranges)
+{
+    const char *s = std::getenv(env);
+    while (s && *s)
+    {
+        char *end = nullptr;
+        const auto lo = std::strtoull(s, &end, 16);
+        if (end == s || *end != '-') break;
+        s = end + 1;
+        const auto hi = std::strtoull(s, &end, 16);
+        if (end == s) break;
+        ranges.push_back({uintptr_t(lo), uintptr_t(hi)});
+        s = end;
+        if (*s == ',') s++;
+    }
+}
+
+PROFILER_NO_INSTRUMENT void read_env()
+{
+    std::lock_guard<std::mutex> guard(globals().mutex);
+    parse_ranges("PROFILER_INSTRUMENT_INCLUDE", globals().include);
+    parse_ranges("PROFILER_INSTRUMENT_EXCLUDE", globals().exclude);
+    if (const char *s = std::getenv("PROFILER_INSTRUMENT_MIN_US"))
+        globals().min_ns.store(int64_t(std::atof(s) * 1e3), std::memory_order_relaxed);
+    globals().generation.fetch_add(1);
+}
+
+PROFILER_NO_INSTRUMENT bool is_recorded(const void *fn)
+{
+    const auto addr = reinterpret_cast<uintptr_t>(fn);
+    std::lock_guard<std::mutex> guard(globals().mutex);
+    bool included = globals().include.empty();
+    for (const auto &r: globals().include)
+        if (addr >= r.lo && addr < r.hi) included = true;
+    for (const auto &r: globals().exclude)
+        if (addr >= r.lo && addr < r.hi) included = false;
+    return included;
+}
+
+PROFILER_NO_INSTRUMENT ThreadState *this_thread_state()
+{
+    thread_local ThreadState *state = nullptr;
+    if (!state)
+    {
+        std::call_once(globals().env_once, read_env);
+        state = new ThreadState();
+        state->root = Node{nullptr, nullptr, nullptr, nullptr, 0, 0, 0};
+        state->current = &state->root;
+        state->stack.reserve(256);
+        state->funcs.resize(1024);
+        state->nfuncs = 0;
+        state->in_hook = false;
+        std::lock_guard<std::mutex> guard(globals().mutex);
+        state->index = unsigned(globals().threads.size());
+        globals().threads.push_back(state);
+    }
+    return state;
+}
+
+// Open addressing table of function states, mask = capacity - 1
+PROFILER_NO_INSTRUMENT FuncState &lookup_func(ThreadState *ts, const void *fn)
+{
+    if (2 * (ts->nfuncs + 1) > ts->funcs.size())
+    {
+        std::vector<FuncState> old(ts->funcs.size() * 2);
+        old.swap(ts->funcs);
+        ts->nfuncs = 0;
+        for (const auto &f: old)
+        {
+            if (!f.fn) continue;
+            auto &slot = lookup_func(ts, f.fn);
+            slot = f;
+        }
+    }
+    const size_t mask = ts->funcs.size() - 1;
+    size_t i = (reinterpret_cast<uintptr_t>(fn) >> 4) * 0x9E3779B97F4A7C15ULL & mask;
+    while (ts->funcs[i].fn && ts->funcs[i].fn != fn) i = (i + 1) & mask;
+    auto &f = ts->funcs[i];
+    if (!f.fn)
+    {
+        f = FuncState{fn, 0, false, 0, 0};
+        ts->nfuncs++;
+    }
+    return f;
+}
+
+PROFILER_NO_INSTRUMENT Node *child_of(Node *parent, const void *fn)
+{
+    Node *prev = nullptr;
+    for (Node *c = parent->child; c; prev = c, c = c->next)
+    {
+        if (c->fn != fn) continue;
+        // move to front, hot callees are found first
+        if (prev)
+        {
+            prev->next = c->next;
+            c->next = parent->child;
+            parent->child = c;
+        }
+        return c;
+    }
+    Node *c = new Node{fn, parent, nullptr, parent->child, 0, 0, 0};
+    parent->child = c;
+    return c;
+}
+
+PROFILER_NO_INSTRUMENT std::string symbolize(const void *fn)
+{
+    std::ostringstream ss;
+#if defined(__linux__) || defined(__APPLE__)
+    Dl_info info;
+    if (dladdr(fn, &info) && info.dli_sname)
+    {
+        int status = 0;
+        char *demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+        ss << (status == 0 && demangled ? demangled : info.dli_sname);
+        std::free(demangled);
+        return ss.str();
+    }
+#endif
+#if defined(__linux__)
+    // No exported symbol, report module and offset for addr2line
+    std::ifstream maps("/proc/self/maps");
+    std::string line;
+    const auto addr = reinterpret_cast<uintptr_t>(fn);
+    while (std::getline(maps, line))
+    {
+        unsigned long lo, hi, offset;
+        char perms[8];
+        char path[4096] = "";
+        if (std::sscanf(line.c_str(), "%lx-%lx %7s %lx %*s %*s %4095s", &lo, &hi, perms, &offset, path) < 4)
+            continue;
+        if (addr < lo || addr >= hi) continue;
+        const char *base = std::strrchr(path, '/');
+        ss << (base ? base + 1 : path) << "+0x" << std::hex << (addr - lo + offset);
+        return ss.str();
+    }
+#endif
+    ss << fn;
+    return ss.str();
+}
+
+PROFILER_NO_INSTRUMENT void print_node(std::ostream &os, const Node *node, std::map<const void *, std::string> &names,
+                                       const int level, const int verbose)
+{
+    for (const Node *c = node; c; c = c->next)
+    {
+        if (c->ncalls == 0) continue;
+        auto &name = names[c->fn];
+        if (name.empty()) name = symbolize(c->fn);
+        int64_t ns_children = 0;
+        for (const Node *cc = c->child; cc; cc = cc->next) ns_children += cc->ns_accu;
+        const std::string indent_s(level, ' ');
+        std::ostringstream cstr_walltime, cstr_selftime;
+        cstr_walltime << std::fixed << std::setprecision(4) << c->ns_accu * 1e-9;
+        cstr_selftime << std::fixed << std::setprecision(4) << (c->ns_accu - ns_children) * 1e-9;
+        os << std::setw(49) << (indent_s + name) << " " << std::setw(12) << c->ncalls << " "
+           << std::setw(18) << (indent_s + cstr_walltime.str()) << " "
+           << std::setw(18) << (indent_s + cstr_selftime.str()) << "\n";
+        if (c->child && verbose > level) print_node(os, c->child, names, level + 1, verbose);
+    }
+}
+
+PROFILER_NO_INSTRUMENT void save_node(std::ostream &os, const Node *node, std::map<const void *, std::string> &names,
+                                      const int level, const std::string &prefix)
+{
+    for (const Node *c = node; c; c = c->next)
+    {
+        if (c->ncalls == 0) continue;
+        auto &name = names[c->fn];
+        if (name.empty()) name = symbolize(c->fn);
+        const auto path = prefix.empty() ? name : prefix + "/" + name;
+        os << level << "\t" << sanitize_field(path) << "\t" << c->ncalls << "\t" << 0 << "\t" << c->ns_accu * 1e-9
+           << "\t\n";
+        if (c->child) save_node(os, c->child, names, level + 1, path);
+    }
+}
+
+struct ReportAtExit
+{
+    PROFILER_NO_INSTRUMENT ~ReportAtExit()
+    {
+        if (const char *prefix = std::getenv("PROFILER_INSTRUMENT_SAVE"))
+        {
+            for (unsigned i = 0; i < nthreads(); i++)
+            {
+                std::ofstream ofs(std::string(prefix) + "_" + std::to_string(i) + ".txt");
+                save(ofs, i);
+            }
+        }
+        const auto s = get_profile_string();
+        const char *fname = std::getenv("PROFILER_INSTRUMENT_OUTPUT");
+        if (fname)
+        {
+            std::ofstream ofs(fname);
+            ofs << s;
+        }
+        else
+            std::cerr << s;
+    }
+} g_report_at_exit;
+
+}
+
+PROFILER_NO_INSTRUMENT void include_range(const void *lo, const void *hi) noexcept
+{
+    std::lock_guard<std::mutex> guard(globals().mutex);
+    globals().include.push_back({reinterpret_cast<uintptr_t>(lo), reinterpret_cast<uintptr_t>(hi)});
+    globals().generation.fetch_add(1);
+}
+
+PROFILER_NO_INSTRUMENT void exclude_range(const void *lo, const void *hi) noexcept
+{
+    std::lock_guard<std::mutex> guard(globals().mutex);
+    globals().exclude.push_back({reinterpret_cast<uintptr_t>(lo), reinterpret_cast<uintptr_t>(hi)});
+    globals().generation.fetch_add(1);
+}
+
+PROFILER_NO_INSTRUMENT void set_min_duration(double seconds) noexcept
+{
+    globals().min_ns.store(int64_t(seconds * 1e9), std::memory_order_relaxed);
+    globals().generation.fetch_add(1);
+}
+
+PROFILER_NO_INSTRUMENT std::string get_profile_string(const int verbose)
+{
+    std::vector<ThreadState *> threads;
+    {
+        std::lock_guard<std::mutex> guard(globals().mutex);
+        threads = globals().threads;
+    }
+    std::map<const void *, std::string> names;
+    std::ostringstream output;
+    output << std::left;
+    for (const auto *ts: threads)
+    {
+        output << banner('-', 100) << "\n";
+        output << "Thread " << ts->index << "\n";
+        output << std::setw(49) << "Function" << " " << std::setw(12) << "#calls" << " "
+            << std::setw(18) << "Wall time (s)" << " " << std::setw(18) << "Self time (s)" << "\n";
+        output << banner('-', 100) << "\n";
+        print_node(output, ts->root.child, names, 0, verbose);
+    }
+    output << banner('-', 100) << "\n";
+    return output.str();
+}
+
+PROFILER_NO_INSTRUMENT unsigned nthreads()
+{
+    std::lock_guard<std::mutex> guard(globals().mutex);
+    return unsigned(globals().threads.size());
+}
+
+PROFILER_NO_INSTRUMENT void save(std::ostream &os, const unsigned thread)
+{
+    const ThreadState *ts = nullptr;
+    {
+        std::lock_guard<std::mutex> guard(globals().mutex);
+        if (thread < globals().threads.size()) ts = globals().threads[thread];
+    }
+    const auto flags = os.flags();
+    const auto precision = os.precision();
+    os << std::setprecision(9);
+    os << saved_profile_header << "\n";
+    os << "# thread\t" << thread << "\n";
+    std::map<const void *, std::string> names;
+    if (ts) save_node(os, ts->root.child, names, 0, "");
+    os.flags(flags);
+    os.precision(precision);
+}
+
+}
+}
+
+using namespace Profiler::instrument;
+
+extern "C" {
+
+PROFILER_NO_INSTRUMENT void __cyg_profile_func_enter(void *fn, void *)
+{
+    ThreadState *ts = this_thread_state();
+    if (ts->in_hook) return;
+    ts->in_hook = true;
+    auto &f = lookup_func(ts, fn);
+    const auto generation = globals().generation.load(std::memory_order_relaxed);
+    if (f.generation != generation)
+    {
+        f.generation = generation;
+        f.recorded = is_recorded(fn);
+        f.ncalls = 0;
+        f.ns_accu = 0;
+    }
+    if (!f.recorded)
+    {
+        ts->stack.push_back(nullptr);
+        ts->in_hook = false;
+        return;
+    }
+    Node *node = child_of(ts->current, fn);
+    ts->stack.push_back(node);
+    ts->current = node;
+    node->ncalls++;
+    node->ns_start = now_ns();
+    ts->in_hook = false;
+}
+
+PROFILER_NO_INSTRUMENT void __cyg_profile_func_exit(void *fn, void *)
+{
+    const auto ns_end = now_ns();
+    ThreadState *ts = this_thread_state();
+    if (ts->in_hook || ts->stack.empty()) return;
+    ts->in_hook = true;
+    Node *node = ts->stack.back();
+    ts->stack.pop_back();
+    if (node)
+    {
+        const auto ns = ns_end - node->ns_start;
+        node->ns_accu += ns;
+        ts->current = node->parent;
+        const auto min_ns = globals().min_ns.load(std::memory_order_relaxed);
+        if (min_ns > 0)
+        {
+            auto &f = lookup_func(ts, fn);
+            f.ncalls++;
+            f.ns_accu += ns;
+            // Too short to be worth the clock reads, stop timing it from now on
+            if (f.ncalls == probe_calls && f.ns_accu < min_ns * int64_t(probe_calls))
+                f.recorded = false;
+        }
+    }
+    ts->in_hook = false;
+}
+
+}
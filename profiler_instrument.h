@@ -0,0 +1,50 @@
+#pragma once
+// Automatic function-level profiling with -finstrument-functions.
+//
+// Compile the code to profile with -finstrument-functions, and link it with
+// profiler_instrument.cpp compiled WITHOUT that flag:
+//
+//   $CXX -O2 -c profiler_instrument.cpp
+//   $CXX -O2 -finstrument-functions -rdynamic app.cpp profiler_instrument.o -ldl
+//
+// Each thread records its own call tree keyed by function address.
+// Addresses are only resolved to names when the report is generated.
+// The report is written at exit to the file named by PROFILER_INSTRUMENT_OUTPUT,
+// or to stderr when that variable is not set.
+//
+// The hooks do not drive a Profiler: its timers are looked up by name, which would resolve every function
+// to a symbol inside the hook, and starting a timer that is already running restarts it, which breaks
+// recursive calls. The trees are instead written in the format of Profiler::save (see save), so that the
+// tools reading saved profiles (load_profile, AccumulatorTable, tools/html_report.cpp) apply to them.
+//
+// Environment variables read at the first instrumented call:
+//   PROFILER_INSTRUMENT_INCLUDE   comma-separated address ranges "0xlo-0xhi" to record
+//   PROFILER_INSTRUMENT_EXCLUDE   comma-separated address ranges "0xlo-0xhi" to skip
+//   PROFILER_INSTRUMENT_MIN_US    functions whose mean call is shorter than this are no longer timed
+//   PROFILER_INSTRUMENT_SAVE      prefix of the files PREFIX_<thread>.txt where save writes each thread at exit
+#include <ostream>
+#include <string>
+
+namespace Profiler {
+namespace instrument {
+
+//! Only record functions with address in [lo, hi). Without any include range all functions are recorded.
+void include_range(const void *lo, const void *hi) noexcept;
+
+//! Do not record functions with address in [lo, hi)
+void exclude_range(const void *lo, const void *hi) noexcept;
+
+//! Stop timing functions whose mean duration over their first calls is below seconds
+void set_min_duration(double seconds) noexcept;
+
+//! Get the profile of all threads. Threads still running may be reported inconsistently.
+std::string get_profile_string(const int verbose = 99);
+
+//! Number of threads that made instrumented calls
+unsigned nthreads();
+
+//! Write the call tree of thread in the format of Profiler::save, with cpu times of 0
+void save(std::ostream &os, const unsigned thread);
+
+}
+}
@@ -0,0 +1,581 @@
+#pragma once
+// MPI helpers of the profiler, for programs built with an MPI compiler wrapper.
+#include "profiler.h"
+
+#include <mpi.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Profiler {
+
+namespace detail
+{
+// Ping-pong rounds of one rank against rank 0 on comm, return the round with the smallest round-trip time.
+// The PMPI entry points keep the pings out of the communication matrix of profiler_comm.cpp.
+inline ClockSample ping_rank0(MPI_Comm comm, const int nrounds)
+{
+    ClockSample best;
+    best.rtt_ns = HUGE_VAL;
+    for (int k = 0; k < nrounds; k++)
+    {
+        const char ping = 0;
+        int64_t t_root = 0;
+        const auto t1 = system_clock_ns();
+        PMPI_Send(&ping, 1, MPI_CHAR, 0, 0, comm);
+        PMPI_Recv(&t_root, 1, MPI_INT64_T, 0, 0, comm, MPI_STATUS_IGNORE);
+        const auto t2 = system_clock_ns();
+        // The reply was stamped in the middle of the round trip, up to rtt / 2
+        if (double(t2 - t1) < best.rtt_ns)
+        {
+            best.local_ns = t1 + (t2 - t1) / 2;
+            best.offset_ns = double(best.local_ns - t_root);
+            best.rtt_ns = double(t2 - t1);
+        }
+    }
+    return best;
+}
+
+// FNV-1a hash, identical on all ranks
+inline uint64_t fnv1a(const std::string &s) noexcept
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (const char c: s)
+    {
+        h ^= uint8_t(c);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Self time of each node of a table holding one profile, nodes in pre-order
+inline std::vector<double> self_times(const AccumulatorTable &table)
+{
+    std::vector<double> wall(table.profiles[0].wall_time);
+    wall.resize(table.size(), 0.0);
+    std::vector<double> self(wall);
+    std::vector<size_t> stack;
+    for (size_t i = 0; i < table.size(); i++)
+    {
+        while (int(stack.size()) > table.depths[i]) stack.pop_back();
+        if (!stack.empty()) self[stack.back()] -= wall[i];
+        stack.push_back(i);
+    }
+    return self;
+}
+
+inline double squared_distance(const std::vector<double> &a, const double *b) noexcept
+{
+    double d = 0.0;
+    for (size_t i = 0; i < a.size(); i++) d += (a[i] - b[i]) * (a[i] - b[i]);
+    return d;
+}
+}
+
+//! Measure the offset of the system clock of each rank to that of rank 0 of comm, keeping the
+//! fastest of nrounds ping-pongs. Collective over comm. Rank 0 serves the ranks one after the other.
+//! The ping-pongs call PMPI_Send and PMPI_Recv, so the communication matrix does not count them.
+inline ClockSample measure_clock_offset(MPI_Comm comm, const int nrounds = 16)
+{
+    MPI_Comm sync_comm;
+    MPI_Comm_dup(comm, &sync_comm);
+    int rank, size;
+    MPI_Comm_rank(sync_comm, &rank);
+    MPI_Comm_size(sync_comm, &size);
+    ClockSample sample;
+    if (rank == 0)
+    {
+        sample.local_ns = system_clock_ns();
+        for (int r = 1; r < size; r++)
+        {
+            for (int k = 0; k < nrounds; k++)
+            {
+                char ping;
+                PMPI_Recv(&ping, 1, MPI_CHAR, r, 0, sync_comm, MPI_STATUS_IGNORE);
+                const int64_t t_root = system_clock_ns();
+                PMPI_Send(&t_root, 1, MPI_INT64_T, r, 0, sync_comm);
+            }
+        }
+    }
+    else
+        sample = detail::ping_rank0(sync_comm, nrounds);
+    MPI_Comm_free(&sync_comm);
+    return sample;
+}
+
+//! Add a clock sample against rank 0 of comm to profiler. Call it after MPI_Init and again before
+//! MPI_Finalize, so that the traces of all ranks are corrected for the offset and the drift of their clocks.
+template <typename P>
+void sync_clocks(P &profiler, MPI_Comm comm, const int nrounds = 16)
+{
+    profiler.add_clock_sample(measure_clock_offset(comm, nrounds));
+}
+
+//! Periodic detection of ranks that spend much more time in a timer than the mean over the ranks.
+//! Every period, the wall time added to each timer since the last period is summed over the ranks with
+//! MPI_Iallreduce on a duplicated communicator, one slot per timer path. The ranks agree on the slots:
+//! when any rank has timers without a slot, the round goes on with a non-blocking gathering of their
+//! paths, which all the ranks add in the same order, up to max_paths. Time of a timer before it has a
+//! slot is not compared.
+//! A rank whose time in a timer exceeds the mean by more than threshold logs an alert with its rank and host.
+//! There is no background thread: the rounds only advance inside poll() and finish(). The constructor and
+//! finish() are collective. Call poll() often, e.g. once per iteration: it only tests the pending
+//! communication unless a period has elapsed, so the reductions overlap with the computation.
+template <typename P>
+class StragglerMonitor
+{
+public:
+    struct Alert
+    {
+        //! end of the period, seconds since the monitor started
+        double time;
+        std::string path;
+        //! time of this rank in the period, and mean over the ranks
+        double seconds;
+        double mean;
+    };
+
+    StragglerMonitor(const P &profiler_in, MPI_Comm comm_in, const double period_in = 60.0,
+                     const double threshold_in = 0.3, const size_t max_paths_in = 4096,
+                     std::ostream &os_in = std::cerr)
+        : profiler(profiler_in), period(period_in), threshold(threshold_in), max_paths(max_paths_in), os(&os_in),
+          nannounced(0), stage(Stage::idle), nrounds(0), finished(false)
+    {
+        MPI_Comm_dup(comm_in, &comm);
+        MPI_Comm_dup(comm_in, &control_comm);
+        MPI_Comm_rank(comm, &rank);
+        MPI_Comm_size(comm, &nranks);
+        char name[MPI_MAX_PROCESSOR_NAME];
+        int len = 0;
+        MPI_Get_processor_name(name, &len);
+        host.assign(name, len);
+        t_start_ns = t_last_ns = system_clock_ns();
+    }
+
+    StragglerMonitor(const StragglerMonitor &) = delete;
+    StragglerMonitor &operator=(const StragglerMonitor &) = delete;
+
+    //! Calls finish(), which is collective: destroy the monitors of all ranks at the same point
+    ~StragglerMonitor() { finish(); }
+
+    //! Advance the pending round, start a new one if a period has elapsed
+    void poll()
+    {
+        if (finished) return;
+        while (stage != Stage::idle)
+        {
+            int done = 0;
+            MPI_Test(&request, &done, MPI_STATUS_IGNORE);
+            if (!done) return;
+            advance();
+        }
+        if ((system_clock_ns() - t_last_ns) * 1e-9 >= period) start_round();
+    }
+
+    //! Complete the reductions started by any rank, and check the time since the last period. Collective.
+    void finish()
+    {
+        if (finished) return;
+        // Ranks are at most one round apart, since a round completes only when all ranks started it
+        unsigned long long started = nrounds, target = 0;
+        MPI_Allreduce(&started, &target, 1, MPI_UNSIGNED_LONG_LONG, MPI_MAX, control_comm);
+        wait_round();
+        while (nrounds < target)
+        {
+            start_round();
+            wait_round();
+        }
+        start_round();
+        wait_round();
+        MPI_Comm_free(&comm);
+        MPI_Comm_free(&control_comm);
+        finished = true;
+    }
+
+    const std::vector<Alert> &get_alerts() const noexcept { return alerts; }
+
+    //! Get the alerts of this rank
+    std::string get_alerts_string() const
+    {
+        std::ostringstream output;
+        output << std::left;
+        output << "Straggler alerts of rank " << rank << " on " << host << "\n";
+        output << banner('-', 100) << "\n";
+        output << std::setw(12) << "Time (s)" << " " << std::setw(49) << "Entry" << " " << std::setw(12)
+               << "Rank (s)" << " " << std::setw(12) << "Mean (s)" << " " << std::setw(10) << "Ratio" << "\n";
+        output << banner('-', 100) << "\n";
+        for (const auto &a: alerts)
+        {
+            std::ostringstream cstr_time, cstr_rank, cstr_mean, cstr_ratio;
+            cstr_time << std::fixed << std::setprecision(1) << a.time;
+            cstr_rank << std::fixed << std::setprecision(4) << a.seconds;
+            cstr_mean << std::fixed << std::setprecision(4) << a.mean;
+            cstr_ratio << std::fixed << std::setprecision(2) << a.seconds / a.mean;
+            output << std::setw(12) << cstr_time.str() << " " << std::setw(49) << a.path << " " << std::setw(12)
+                   << cstr_rank.str() << " " << std::setw(12) << cstr_mean.str() << " " << std::setw(10)
+                   << cstr_ratio.str() << "\n";
+        }
+        output << banner('-', 100) << "\n";
+        return output.str();
+    }
+
+private:
+    const P &profiler;
+    MPI_Comm comm;
+    //! for the agreement on the number of rounds in finish, while a round may be pending on comm
+    MPI_Comm control_comm;
+    int rank;
+    int nranks;
+    std::string host;
+    double period;
+    double threshold;
+    size_t max_paths;
+    std::ostream *os;
+
+    //! communication of the pending round: the reduction of the times, then, if any rank has timers without
+    //! a slot, the gathering of the lengths and of the paths of these timers
+    enum class Stage
+    {
+        idle,
+        reduce,
+        count,
+        gather
+    };
+
+    //! timer layout of this rank, and the slot (none if not agreed yet) and wall time at the last period of each node
+    AccumulatorTable table;
+    std::vector<uint32_t> node_slots;
+    std::vector<double> last_wall;
+    //! path of each slot, identical on all ranks, and the slot of each path
+    std::vector<std::string> slot_paths;
+    std::unordered_map<std::string, uint32_t> path_slots;
+    //! time of each slot, then the number of timers of the rank without a slot
+    std::vector<double> send;
+    std::vector<double> recv;
+    //! paths without a slot of this rank separated by newlines, their length, and those of all ranks
+    std::string announced;
+    int nannounced;
+    std::vector<int> counts;
+    std::vector<int> displs;
+    std::string gathered;
+    MPI_Request request;
+    Stage stage;
+    unsigned long long nrounds;
+    int64_t t_start_ns;
+    int64_t t_last_ns;
+    //! length of the period of the pending round, seconds
+    double window;
+    std::vector<Alert> alerts;
+    bool finished;
+
+    // Put the wall time added to each timer since the last round into its slot, and reduce the slots
+    void start_round()
+    {
+        const uint32_t no_slot = std::numeric_limits<uint32_t>::max();
+        table.profiles.clear();
+        profiler.export_accumulators(table);
+        const auto &wall = table.profiles[0].wall_time;
+        node_slots.resize(table.size(), no_slot);
+        last_wall.resize(table.size(), 0.0);
+        send.assign(slot_paths.size() + 1, 0.0);
+        recv.assign(slot_paths.size() + 1, 0.0);
+        size_t nunknown = 0;
+        for (size_t i = 0; i < table.size(); i++)
+        {
+            const auto delta = wall[i] - last_wall[i];
+            last_wall[i] = wall[i];
+            if (node_slots[i] != no_slot)
+                send[node_slots[i]] = delta;
+            else if (slot_paths.size() < max_paths)
+                nunknown++;
+        }
+        send.back() = double(nunknown);
+        const auto now = system_clock_ns();
+        window = (now - t_last_ns) * 1e-9;
+        t_last_ns = now;
+        MPI_Iallreduce(send.data(), recv.data(), int(send.size()), MPI_DOUBLE, MPI_SUM, comm, &request);
+        stage = Stage::reduce;
+        nrounds++;
+    }
+
+    // Go on with the round after the completion of request. All the ranks take the same steps, as they
+    // depend on the reduced number of timers without a slot.
+    void advance()
+    {
+        const uint32_t no_slot = std::numeric_limits<uint32_t>::max();
+        switch (stage)
+        {
+        case Stage::reduce:
+            complete_round();
+            if (recv.back() == 0.0)
+            {
+                stage = Stage::idle;
+                break;
+            }
+            announced.clear();
+            for (size_t i = 0; i < table.size(); i++)
+                if (node_slots[i] == no_slot) announced += table.paths[i] + "\n";
+            nannounced = int(announced.size());
+            counts.assign(nranks, 0);
+            MPI_Iallgather(&nannounced, 1, MPI_INT, counts.data(), 1, MPI_INT, comm, &request);
+            stage = Stage::count;
+            break;
+        case Stage::count:
+            displs.assign(nranks, 0);
+            for (int r = 1; r < nranks; r++) displs[r] = displs[r - 1] + counts[r - 1];
+            gathered.assign(size_t(displs.back() + counts.back()), '\0');
+            MPI_Iallgatherv(announced.data(), nannounced, MPI_CHAR, &gathered[0], counts.data(), displs.data(),
+                            MPI_CHAR, comm, &request);
+            stage = Stage::gather;
+            break;
+        case Stage::gather:
+            // In the order of the ranks, so that the slots are the same everywhere
+            for (size_t pos = 0, end; pos < gathered.size() && slot_paths.size() < max_paths; pos = end + 1)
+            {
+                end = gathered.find('\n', pos);
+                if (end == std::string::npos) end = gathered.size();
+                const auto path = gathered.substr(pos, end - pos);
+                if (path_slots.emplace(path, uint32_t(slot_paths.size())).second) slot_paths.push_back(path);
+            }
+            for (size_t i = 0; i < table.size(); i++)
+            {
+                const auto it = path_slots.find(table.paths[i]);
+                if (it != path_slots.end()) node_slots[i] = it->second;
+            }
+            stage = Stage::idle;
+            break;
+        case Stage::idle:
+            break;
+        }
+    }
+
+    void wait_round()
+    {
+        while (stage != Stage::idle)
+        {
+            MPI_Wait(&request, MPI_STATUS_IGNORE);
+            advance();
+        }
+    }
+
+    void complete_round()
+    {
+        for (size_t s = 0; s < slot_paths.size(); s++)
+        {
+            const double mean = recv[s] / nranks;
+            // Timers taking less than 1% of the period are not worth an alert
+            if (mean < 0.01 * window || send[s] <= (1.0 + threshold) * mean) continue;
+            alerts.push_back({(t_last_ns - t_start_ns) * 1e-9, slot_paths[s], send[s], mean});
+            if (os)
+                *os << get_timestamp() << " Straggler: rank " << rank << " on " << host << " spent "
+                    << std::setprecision(3) << send[s] / mean << "x the mean time of " << nranks << " ranks in "
+                    << slot_paths[s] << " (" << send[s] << " s vs " << mean << " s) over the last " << window
+                    << " s" << std::endl;
+        }
+    }
+};
+
+//! Clusters of the ranks of a communicator, see cluster_ranks
+struct RankClustering
+{
+    //! cluster of the calling rank
+    int cluster = 0;
+    //! number of ranks, and rank closest to the center, of each cluster
+    std::vector<int> sizes;
+    std::vector<int> representatives;
+    //! mean time of the ranks of each cluster, seconds
+    std::vector<double> mean_time;
+    int niterations = 0;
+    //! table of the clusters, on rank 0 only
+    std::string report;
+};
+
+//! Group the ranks of comm with similar profiles, with k-means over the self times of the timers.
+//! Timers are hashed by path into nslots features, so that ranks with different timers can be compared.
+//! The centers start from the ranks farthest from the previous centers, and every iteration only
+//! reduces k * nslots sums, so the cost does not grow with the number of ranks. Collective.
+//! Ranks closer to the centers than min_separation times the mean time of the ranks start no new cluster,
+//! so that there may be less than k clusters.
+template <typename P>
+RankClustering cluster_ranks(const P &profiler, MPI_Comm comm, int k = 8, const double min_separation = 0.05,
+                             const size_t nslots = 256, const int max_iterations = 100)
+{
+    MPI_Comm cluster_comm;
+    MPI_Comm_dup(comm, &cluster_comm);
+    int rank, size;
+    MPI_Comm_rank(cluster_comm, &rank);
+    MPI_Comm_size(cluster_comm, &size);
+
+    AccumulatorTable table;
+    profiler.export_accumulators(table);
+    const auto self = detail::self_times(table);
+    std::vector<double> features(nslots, 0.0), largest(nslots, 0.0);
+    std::vector<std::string> slot_paths(nslots);
+    for (size_t i = 0; i < table.size(); i++)
+    {
+        const auto slot = detail::fnv1a(table.paths[i]) % nslots;
+        features[slot] += self[i];
+        if (self[i] > largest[slot])
+        {
+            largest[slot] = self[i];
+            slot_paths[slot] = table.paths[i];
+        }
+    }
+
+    // Farthest-first initialization, stops early when all ranks are close to a center
+    double local_time = 0.0, sum_time = 0.0;
+    for (const auto f: features) local_time += f;
+    MPI_Allreduce(&local_time, &sum_time, 1, MPI_DOUBLE, MPI_SUM, cluster_comm);
+    const double separation = min_separation * sum_time / size;
+    k = std::max(1, std::min(k, size));
+    std::vector<double> centers(nslots);
+    if (rank == 0) centers = features;
+    MPI_Bcast(centers.data(), int(nslots), MPI_DOUBLE, 0, cluster_comm);
+    double min_distance = detail::squared_distance(features, centers.data());
+    for (int c = 1; c < k; c++)
+    {
+        struct { double distance; int rank; } local = {min_distance, rank}, farthest;
+        MPI_Allreduce(&local, &farthest, 1, MPI_DOUBLE_INT, MPI_MAXLOC, cluster_comm);
+        if (farthest.distance <= separation * separation)
+        {
+            k = c;
+            break;
+        }
+        centers.resize((c + 1) * nslots);
+        if (rank == farthest.rank) std::copy(features.begin(), features.end(), centers.begin() + c * nslots);
+        MPI_Bcast(&centers[c * nslots], int(nslots), MPI_DOUBLE, farthest.rank, cluster_comm);
+        min_distance = std::min(min_distance, detail::squared_distance(features, &centers[c * nslots]));
+    }
+
+    // Lloyd iterations: assign to the nearest center, move the centers to the mean of their ranks
+    RankClustering result;
+    result.cluster = -1;
+    std::vector<double> sums((nslots + 1) * k);
+    std::vector<double> reduced((nslots + 1) * k);
+    for (int it = 0; it < max_iterations; it++)
+    {
+        int nearest = 0;
+        double best = HUGE_VAL;
+        for (int c = 0; c < k; c++)
+        {
+            const auto d = detail::squared_distance(features, &centers[c * nslots]);
+            if (d < best)
+            {
+                best = d;
+                nearest = c;
+            }
+        }
+        int changed = nearest != result.cluster, nchanged = 0;
+        result.cluster = nearest;
+        MPI_Allreduce(&changed, &nchanged, 1, MPI_INT, MPI_SUM, cluster_comm);
+        result.niterations = it + 1;
+        if (nchanged == 0) break;
+
+        // count of each cluster in the last column
+        std::fill(sums.begin(), sums.end(), 0.0);
+        std::copy(features.begin(), features.end(), sums.begin() + nearest * (nslots + 1));
+        sums[nearest * (nslots + 1) + nslots] = 1.0;
+        MPI_Allreduce(sums.data(), reduced.data(), int(sums.size()), MPI_DOUBLE, MPI_SUM, cluster_comm);
+        for (int c = 0; c < k; c++)
+        {
+            const auto n = reduced[c * (nslots + 1) + nslots];
+            if (n == 0.0) continue;
+            for (size_t j = 0; j < nslots; j++) centers[c * nslots + j] = reduced[c * (nslots + 1) + j] / n;
+        }
+    }
+
+    // Sizes, and the rank closest to each center
+    std::vector<int> ones(k, 0);
+    ones[result.cluster] = 1;
+    result.sizes.assign(k, 0);
+    MPI_Allreduce(ones.data(), result.sizes.data(), k, MPI_INT, MPI_SUM, cluster_comm);
+    struct DistanceRank { double distance; int rank; };
+    std::vector<DistanceRank> local(k, {HUGE_VAL, rank}), closest(k);
+    local[result.cluster].distance = detail::squared_distance(features, &centers[result.cluster * nslots]);
+    MPI_Allreduce(local.data(), closest.data(), k, MPI_DOUBLE_INT, MPI_MINLOC, cluster_comm);
+    std::vector<double> mean_features(nslots, 0.0);
+    for (int c = 0; c < k; c++)
+    {
+        result.representatives.push_back(closest[c].rank);
+        double total = 0.0;
+        for (size_t j = 0; j < nslots; j++)
+        {
+            total += centers[c * nslots + j];
+            mean_features[j] += centers[c * nslots + j] * result.sizes[c] / size;
+        }
+        result.mean_time.push_back(total);
+    }
+
+    // Each representative describes its cluster with its entries furthest above the mean of all ranks
+    std::string line;
+    for (int c = 0; c < k; c++)
+    {
+        if (result.representatives[c] != rank || result.sizes[c] == 0) continue;
+        std::vector<size_t> order(nslots);
+        for (size_t j = 0; j < nslots; j++) order[j] = j;
+        const double *center = &centers[c * nslots];
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            return center[a] - mean_features[a] > center[b] - mean_features[b];
+        });
+        std::ostringstream cstr_time, cstr_entries;
+        cstr_time << std::fixed << std::setprecision(4) << result.mean_time[c];
+        for (size_t j = 0; j < 2 && j < nslots; j++)
+        {
+            const auto s = order[j];
+            if (center[s] - mean_features[s] <= 0.01 * result.mean_time[c] || slot_paths[s].empty()) break;
+            cstr_entries << (j ? ", " : "") << slot_paths[s] << " +" << std::setprecision(3)
+                         << center[s] - mean_features[s];
+        }
+        std::ostringstream output;
+        output << std::left << std::setw(8) << c << " " << std::setw(8) << result.sizes[c] << " " << std::setw(15)
+               << rank << " " << std::setw(14) << cstr_time.str() << " " << cstr_entries.str() << "\n";
+        line += output.str();
+    }
+    const int nline = int(line.size());
+    std::vector<int> counts(rank == 0 ? size : 0), displs(rank == 0 ? size : 0);
+    MPI_Gather(&nline, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, cluster_comm);
+    std::string lines;
+    if (rank == 0)
+    {
+        int total = 0;
+        for (int r = 0; r < size; r++)
+        {
+            displs[r] = total;
+            total += counts[r];
+        }
+        lines.resize(total);
+    }
+    MPI_Gatherv(line.data(), nline, MPI_CHAR, &lines[0], counts.data(), displs.data(), MPI_CHAR, 0, cluster_comm);
+    MPI_Comm_free(&cluster_comm);
+    if (rank != 0) return result;
+
+    // Lines arrive in the order of the representatives, sort them by cluster
+    std::vector<std::string> rows;
+    std::istringstream is(lines);
+    for (std::string l; std::getline(is, l);) rows.push_back(l);
+    std::sort(rows.begin(), rows.end(), [](const std::string &a, const std::string &b) {
+        return std::stoi(a) < std::stoi(b);
+    });
+    std::ostringstream output;
+    output << std::left;
+    output << k << " clusters of " << size << " ranks after " << result.niterations << " iterations\n";
+    output << banner('-', 100) << "\n";
+    output << std::setw(8) << "Cluster" << " " << std::setw(8) << "#ranks" << " " << std::setw(15)
+           << "Representative" << " " << std::setw(14) << "Mean time (s)" << " "
+           << "Entries above the mean of all ranks (s)" << "\n";
+    output << banner('-', 100) << "\n";
+    for (const auto &r: rows) output << r << "\n";
+    output << banner('-', 100) << "\n";
+    result.report = output.str();
+    return result;
+}
+
+}
@@ -0,0 +1,425 @@
+#pragma once
+#include "profiler.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#if __cplusplus >= 201402L
+#include <shared_mutex>
+#endif
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace Profiler {
+
+//! Contention statistics of a named lock, shared by all lock objects with the same name
+class LockStats
+{
+public:
+    //! Number of log2(ns) buckets of the wait-time histogram. The last bucket is open-ended.
+    static constexpr int nbins = 32;
+
+    //! Contention attributed to one timer
+    struct TimerEntry
+    {
+        size_t ncontended = 0;
+        double wait_time = 0.0;
+        double hold_time = 0.0;
+    };
+
+    //! Counters of the contention attributed to one timer, at a stable address
+    struct TimerSlot
+    {
+        std::atomic<size_t> ncontended{0};
+        std::atomic<int64_t> wait_ns{0};
+        std::atomic<int64_t> hold_ns{0};
+    };
+
+    const std::string name;
+    //! acquisitions of lock objects that have been destroyed, live ones are summed at report time
+    std::atomic<size_t> nacquires_retired{0};
+    std::atomic<size_t> ncontended{0};
+    std::atomic<int64_t> wait_ns{0};
+    std::atomic<int64_t> max_wait_ns{0};
+    std::atomic<int64_t> hold_ns{0};
+    std::atomic<size_t> hist[nbins];
+
+    explicit LockStats(const std::string &lname) : name(lname)
+    {
+        for (auto &h: hist) h.store(0, std::memory_order_relaxed);
+    }
+
+    static int bin_of(int64_t ns) noexcept
+    {
+        int b = 0;
+        while (ns > 1 && b < nbins - 1) { ns >>= 1; b++; }
+        return b;
+    }
+
+    //! Counters of the timer named by timer (null outside timers), created at its first contention.
+    //! The name is copied, the slot stays valid when the profiler owning the timer is destroyed.
+    TimerSlot *slot(const std::string *timer)
+    {
+        std::lock_guard<std::mutex> guard(mtx);
+        return &by_timer[timer ? *timer : std::string("<no timer>")];
+    }
+
+    //! Record a contended acquisition that waited ns nanoseconds
+    void record_wait(int64_t ns, TimerSlot *timer) noexcept
+    {
+        ncontended.fetch_add(1, std::memory_order_relaxed);
+        wait_ns.fetch_add(ns, std::memory_order_relaxed);
+        hist[bin_of(ns)].fetch_add(1, std::memory_order_relaxed);
+        auto prev = max_wait_ns.load(std::memory_order_relaxed);
+        while (ns > prev && !max_wait_ns.compare_exchange_weak(prev, ns, std::memory_order_relaxed)) {}
+        timer->ncontended.fetch_add(1, std::memory_order_relaxed);
+        timer->wait_ns.fetch_add(ns, std::memory_order_relaxed);
+    }
+
+    //! Record the hold time following a contended acquisition
+    void record_hold(int64_t ns, TimerSlot *timer) noexcept
+    {
+        hold_ns.fetch_add(ns, std::memory_order_relaxed);
+        timer->hold_ns.fetch_add(ns, std::memory_order_relaxed);
+    }
+
+    void attach(const std::atomic<size_t> *counter)
+    {
+        std::lock_guard<std::mutex> guard(mtx);
+        live.push_back(counter);
+    }
+
+    void detach(const std::atomic<size_t> *counter)
+    {
+        std::lock_guard<std::mutex> guard(mtx);
+        for (size_t i = 0; i < live.size(); i++)
+        {
+            if (live[i] == counter)
+            {
+                nacquires_retired.fetch_add(counter->load(std::memory_order_relaxed), std::memory_order_relaxed);
+                live.erase(live.begin() + i);
+                break;
+            }
+        }
+    }
+
+    size_t nacquires()
+    {
+        std::lock_guard<std::mutex> guard(mtx);
+        size_t n = nacquires_retired.load(std::memory_order_relaxed);
+        for (const auto *c: live) n += c->load(std::memory_order_relaxed);
+        return n;
+    }
+
+    std::map<std::string, TimerEntry> timer_entries()
+    {
+        std::lock_guard<std::mutex> guard(mtx);
+        std::map<std::string, TimerEntry> entries;
+        for (const auto &kv: by_timer)
+        {
+            auto &e = entries[kv.first];
+            e.ncontended = kv.second.ncontended.load(std::memory_order_relaxed);
+            e.wait_time = kv.second.wait_ns.load(std::memory_order_relaxed) * 1e-9;
+            e.hold_time = kv.second.hold_ns.load(std::memory_order_relaxed) * 1e-9;
+        }
+        return entries;
+    }
+
+private:
+    std::mutex mtx;
+    std::map<std::string, TimerSlot> by_timer;
+    std::vector<const std::atomic<size_t> *> live;
+};
+
+namespace detail
+{
+struct LockRegistry
+{
+    std::mutex mtx;
+    std::map<std::string, std::unique_ptr<LockStats>> locks;
+};
+
+// Not static: lock statistics are process-wide
+inline LockRegistry &lock_registry()
+{
+    static LockRegistry registry;
+    return registry;
+}
+
+static inline int64_t lock_clock_ns() noexcept
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static inline std::string format_ns(int64_t ns)
+{
+    std::ostringstream ss;
+    ss << std::fixed << std::setprecision(1);
+    if (ns < 1000) ss << ns << "ns";
+    else if (ns < 1000000) ss << ns * 1e-3 << "us";
+    else if (ns < 1000000000) ss << ns * 1e-6 << "ms";
+    else ss << ns * 1e-9 << "s";
+    return ss.str();
+}
+}
+
+//! Get the statistics of lock with name lname, created if not registered yet
+inline LockStats &lock_stats(const std::string &lname)
+{
+    auto &reg = detail::lock_registry();
+    std::lock_guard<std::mutex> guard(reg.mtx);
+    auto &p = reg.locks[lname];
+    if (!p) p.reset(new LockStats(lname));
+    return *p;
+}
+
+//! Common part of the profiled lock wrappers
+template <typename Mutex>
+class profiled_lock_base
+{
+protected:
+    Mutex mtx;
+    LockStats *stats;
+    //! exclusive acquisitions, only written by the owner of the lock
+    std::atomic<size_t> nacquires{0};
+    //! steady clock when a contended exclusive acquisition succeeded, 0 if uncontended
+    int64_t hold_start_ns = 0;
+    LockStats::TimerSlot *hold_timer = nullptr;
+
+    explicit profiled_lock_base(const std::string &lname) : stats(&lock_stats(lname))
+    {
+        stats->attach(&nacquires);
+    }
+
+    ~profiled_lock_base() { stats->detach(&nacquires); }
+
+    void count_acquire() noexcept
+    {
+        nacquires.store(nacquires.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+public:
+    profiled_lock_base(const profiled_lock_base &) = delete;
+    profiled_lock_base &operator=(const profiled_lock_base &) = delete;
+
+    void lock()
+    {
+        if (mtx.try_lock())
+        {
+            count_acquire();
+            return;
+        }
+        const auto timer = stats->slot(active_timer_name());
+        const auto t0 = detail::lock_clock_ns();
+        mtx.lock();
+        hold_start_ns = detail::lock_clock_ns();
+        hold_timer = timer;
+        count_acquire();
+        stats->record_wait(hold_start_ns - t0, timer);
+    }
+
+    bool try_lock()
+    {
+        if (!mtx.try_lock()) return false;
+        count_acquire();
+        return true;
+    }
+
+    void unlock()
+    {
+        if (hold_start_ns == 0)
+        {
+            mtx.unlock();
+            return;
+        }
+        const auto ns = detail::lock_clock_ns() - hold_start_ns;
+        const auto timer = hold_timer;
+        hold_start_ns = 0;
+        mtx.unlock();
+        stats->record_hold(ns, timer);
+    }
+
+    //! Name of the lock
+    const std::string &name() const { return stats->name; }
+};
+
+//! Drop-in replacement of std::mutex that records contention.
+//! Uncontended acquisitions only cost a try_lock, wait and hold times are measured for contended ones.
+class profiled_mutex : public profiled_lock_base<std::mutex>
+{
+public:
+    explicit profiled_mutex(const std::string &lname = "mutex") : profiled_lock_base(lname) {}
+};
+
+#if __cplusplus >= 201402L
+namespace detail
+{
+#if __cplusplus >= 201703L
+using shared_mutex = std::shared_mutex;
+#else
+using shared_mutex = std::shared_timed_mutex;
+#endif
+}
+
+//! Drop-in replacement of std::shared_mutex that records contention, based on std::shared_timed_mutex
+//! before C++17 and not available before C++14.
+//! Shared acquisitions are counted with the exclusive ones, with an atomic increment as readers run
+//! concurrently. Only the wait time of contended shared acquisitions is recorded, not their hold time.
+class profiled_shared_mutex : public profiled_lock_base<detail::shared_mutex>
+{
+private:
+    std::atomic<size_t> nshared{0};
+
+public:
+    explicit profiled_shared_mutex(const std::string &lname = "shared_mutex") : profiled_lock_base(lname)
+    {
+        stats->attach(&nshared);
+    }
+
+    ~profiled_shared_mutex() { stats->detach(&nshared); }
+
+    void lock_shared()
+    {
+        if (!mtx.try_lock_shared())
+        {
+            const auto timer = stats->slot(active_timer_name());
+            const auto t0 = detail::lock_clock_ns();
+            mtx.lock_shared();
+            stats->record_wait(detail::lock_clock_ns() - t0, timer);
+        }
+        nshared.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    bool try_lock_shared()
+    {
+        if (!mtx.try_lock_shared()) return false;
+        nshared.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    void unlock_shared() { mtx.unlock_shared(); }
+};
+#endif
+
+//! Condition variable usable with the profiled locks. Time blocked in wait is recorded as wait time of its name.
+class profiled_condition_variable
+{
+private:
+    std::condition_variable_any cv;
+    LockStats *stats;
+
+public:
+    explicit profiled_condition_variable(const std::string &cvname = "condition_variable")
+        : stats(&lock_stats(cvname)) {}
+
+    profiled_condition_variable(const profiled_condition_variable &) = delete;
+    profiled_condition_variable &operator=(const profiled_condition_variable &) = delete;
+
+    void notify_one() noexcept { cv.notify_one(); }
+    void notify_all() noexcept { cv.notify_all(); }
+
+    template <typename Lock>
+    void wait(Lock &lock)
+    {
+        const auto timer = stats->slot(active_timer_name());
+        const auto t0 = detail::lock_clock_ns();
+        cv.wait(lock);
+        stats->record_wait(detail::lock_clock_ns() - t0, timer);
+    }
+
+    template <typename Lock, typename Predicate>
+    void wait(Lock &lock, Predicate pred)
+    {
+        while (!pred()) wait(lock);
+    }
+
+    template <typename Lock, typename Clock, typename Duration>
+    std::cv_status wait_until(Lock &lock, const std::chrono::time_point<Clock, Duration> &tp)
+    {
+        const auto timer = stats->slot(active_timer_name());
+        const auto t0 = detail::lock_clock_ns();
+        const auto status = cv.wait_until(lock, tp);
+        stats->record_wait(detail::lock_clock_ns() - t0, timer);
+        return status;
+    }
+
+    template <typename Lock, typename Clock, typename Duration, typename Predicate>
+    bool wait_until(Lock &lock, const std::chrono::time_point<Clock, Duration> &tp, Predicate pred)
+    {
+        while (!pred())
+        {
+            if (wait_until(lock, tp) == std::cv_status::timeout) return pred();
+        }
+        return true;
+    }
+
+    template <typename Lock, typename Rep, typename Period>
+    std::cv_status wait_for(Lock &lock, const std::chrono::duration<Rep, Period> &d)
+    {
+        return wait_until(lock, std::chrono::steady_clock::now() + d);
+    }
+
+    template <typename Lock, typename Rep, typename Period, typename Predicate>
+    bool wait_for(Lock &lock, const std::chrono::duration<Rep, Period> &d, Predicate pred)
+    {
+        return wait_until(lock, std::chrono::steady_clock::now() + d, pred);
+    }
+};
+
+//! Get the contention summary of all named locks and condition variables
+inline std::string get_lock_profile_string()
+{
+    std::vector<LockStats *> all;
+    {
+        auto &reg = detail::lock_registry();
+        std::lock_guard<std::mutex> guard(reg.mtx);
+        for (auto &kv: reg.locks) all.push_back(kv.second.get());
+    }
+
+    std::ostringstream output;
+    output << std::left;
+    output << banner('-', 100) << "\n";
+    output << std::setw(37) << "Lock / Timer" << " " << std::setw(12) << "#acquires" << " "
+        << std::setw(12) << "#contended" << " " << std::setw(18) << "Wait time (s)" << " "
+        << std::setw(18) << "Hold time (s)" << "\n";
+    output << banner('-', 100) << "\n";
+    for (auto *stats: all)
+    {
+        std::ostringstream cstr_wait, cstr_hold;
+        cstr_wait << std::fixed << std::setprecision(4) << stats->wait_ns.load() * 1e-9;
+        cstr_hold << std::fixed << std::setprecision(4) << stats->hold_ns.load() * 1e-9;
+        output << std::setw(37) << stats->name << " " << std::setw(12) << stats->nacquires() << " "
+            << std::setw(12) << stats->ncontended.load() << " " << std::setw(18) << cstr_wait.str() << " "
+            << std::setw(18) << cstr_hold.str() << "\n";
+        for (const auto &kv: stats->timer_entries())
+        {
+            std::ostringstream tw, th;
+            tw << std::fixed << std::setprecision(4) << kv.second.wait_time;
+            th << std::fixed << std::setprecision(4) << kv.second.hold_time;
+            output << std::setw(37) << (" " + kv.first) << " " << std::setw(12) << "" << " "
+                << std::setw(12) << kv.second.ncontended << " " << std::setw(18) << (" " + tw.str()) << " "
+                << std::setw(18) << (" " + th.str()) << "\n";
+        }
+        if (stats->ncontended.load() > 0)
+        {
+            output << " wait histogram (max " << detail::format_ns(stats->max_wait_ns.load()) << "):";
+            for (int b = 0; b < LockStats::nbins; b++)
+            {
+                const auto n = stats->hist[b].load();
+                if (n == 0) continue;
+                output << " <" << detail::format_ns(int64_t(2) << b) << ":" << n;
+            }
+            output << "\n";
+        }
+    }
+    output << banner('-', 100) << "\n";
+    return output.str();
+}
+
+}
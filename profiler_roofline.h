@@ -0,0 +1,129 @@
+#pragma once
+// Calibration kernels measuring the machine limits used by Profiler::get_roofline_string.
+// Compile with optimization and the target instruction set, e.g. -O3 -march=native,
+// otherwise the SIMD peak is that of the baseline instruction set.
+#include "profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace Profiler {
+
+namespace detail
+{
+// Run kernel(thread_id) on nthreads threads released at the same time, return the slowest wall time in seconds
+template <typename Kernel>
+double run_on_threads(const int nthreads, Kernel kernel)
+{
+    std::atomic<int> ready{0};
+    std::atomic<bool> go{false};
+    std::vector<double> elapsed(nthreads, 0.0);
+    std::vector<std::thread> threads;
+    for (int it = 0; it < nthreads; it++)
+    {
+        threads.emplace_back([&, it]() {
+            ready++;
+            while (!go.load(std::memory_order_acquire)) {}
+            const auto t0 = std::chrono::steady_clock::now();
+            kernel(it);
+            elapsed[it] = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        });
+    }
+    while (ready.load() < nthreads) {}
+    go.store(true, std::memory_order_release);
+    for (auto &t: threads) t.join();
+    return *std::max_element(elapsed.begin(), elapsed.end());
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+__attribute__((optimize("no-tree-vectorize", "no-tree-slp-vectorize")))
+#endif
+inline double scalar_fma_chains(const long niter, const double a, const double b)
+{
+    // 8 independent chains hide the latency of the floating-point units
+    double x0 = 1.0, x1 = 1.1, x2 = 1.2, x3 = 1.3, x4 = 1.4, x5 = 1.5, x6 = 1.6, x7 = 1.7;
+    for (long i = 0; i < niter; i++)
+    {
+        x0 = x0 * a + b; x1 = x1 * a + b; x2 = x2 * a + b; x3 = x3 * a + b;
+        x4 = x4 * a + b; x5 = x5 * a + b; x6 = x6 * a + b; x7 = x7 * a + b;
+    }
+    return x0 + x1 + x2 + x3 + x4 + x5 + x6 + x7;
+}
+
+inline double simd_fma_chains(const long niter, const double a, const double b)
+{
+    // Enough independent chains for the compiler to fill several vector registers
+    constexpr int nchains = 32;
+    double x[nchains];
+    for (int j = 0; j < nchains; j++) x[j] = 1.0 + 0.01 * j;
+    for (long i = 0; i < niter; i++)
+        for (int j = 0; j < nchains; j++) x[j] = x[j] * a + b;
+    double s = 0.0;
+    for (int j = 0; j < nchains; j++) s += x[j];
+    return s;
+}
+}
+
+//! Measure the STREAM triad bandwidth and the scalar and SIMD peak FLOP rates with nthreads threads.
+//! Each thread works on arrays of array_bytes in total, which should be well beyond the last-level cache.
+inline MachineBalance calibrate_machine(int nthreads = 0, const size_t array_bytes = size_t(64) << 20,
+                                        const int ntrials = 5)
+{
+    if (nthreads <= 0) nthreads = std::max(1, int(std::thread::hardware_concurrency()));
+    MachineBalance machine;
+    machine.nthreads = nthreads;
+
+    // STREAM triad a = b + s * c, counting 24 bytes per element as STREAM does
+    const size_t n = std::max<size_t>(array_bytes / (3 * sizeof(double)), 1024);
+    std::vector<std::vector<double>> a(nthreads), b(nthreads), c(nthreads);
+    // First touch on the owning thread, for NUMA placement
+    detail::run_on_threads(nthreads, [&](const int it) {
+        a[it].assign(n, 0.0);
+        b[it].assign(n, 1.0);
+        c[it].assign(n, 2.0);
+    });
+    double best = 0.0;
+    for (int trial = 0; trial < ntrials; trial++)
+    {
+        const auto t = detail::run_on_threads(nthreads, [&](const int it) {
+            double *pa = a[it].data();
+            const double *pb = b[it].data();
+            const double *pc = c[it].data();
+            for (size_t i = 0; i < n; i++) pa[i] = pb[i] + 3.0 * pc[i];
+        });
+        if (t > 0.0) best = std::max(best, 24.0 * n * nthreads / t * 1e-9);
+    }
+    machine.bandwidth = best;
+
+    // Peak rates, 2 flops per multiply-add
+    const long niter = 20000000;
+    std::vector<double> sink(nthreads);
+    best = 0.0;
+    for (int trial = 0; trial < ntrials; trial++)
+    {
+        const auto t = detail::run_on_threads(nthreads, [&](const int it) {
+            sink[it] = detail::scalar_fma_chains(niter, 0.999999, 1e-7);
+        });
+        if (t > 0.0) best = std::max(best, 2.0 * 8 * niter * nthreads / t * 1e-9);
+    }
+    machine.scalar_gflops = best;
+    best = 0.0;
+    for (int trial = 0; trial < ntrials; trial++)
+    {
+        const auto t = detail::run_on_threads(nthreads, [&](const int it) {
+            sink[it] = detail::simd_fma_chains(niter / 4, 0.999999, 1e-7);
+        });
+        if (t > 0.0) best = std::max(best, 2.0 * 32 * (niter / 4) * nthreads / t * 1e-9);
+    }
+    machine.simd_gflops = std::max(best, machine.scalar_gflops);
+    // Keep the results observable, so that the kernels are not optimized away
+    volatile double keep = 0.0;
+    for (const auto x: sink) keep = keep + x;
+    return machine;
+}
+
+}
@@ -0,0 +1,210 @@
+// Regression checks of the profiler headers.
+//
+//   $CXX -O2 -pthread -I. tests/regressions.cpp -o regressions.exe && ./regressions.exe
+//
+// Prints the failed checks and returns 1 if any.
+#include "profiler.h"
+
+#include <cctype>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+static int nfailed = 0;
+
+#define CHECK(cond)                                                                     \
+    do                                                                                  \
+    {                                                                                   \
+        if (!(cond))                                                                    \
+        {                                                                               \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #cond "\n"; \
+            nfailed++;                                                                  \
+        }                                                                               \
+    } while (0)
+
+// A lookup of a key never started must not leave a null timer in the tree
+static void test_missing_key_lookup()
+{
+    std::ostringstream os;
+    Profiler::Profiler profiler(os);
+    profiler.start("kpt", 1);
+    profiler.stop("kpt", 1);
+    CHECK(profiler.get_wall_time_last("kpt", 7) == 0.0);
+    CHECK(profiler.get_cpu_time_last("kpt", 7) == -1.0);
+    profiler.display();
+    std::ostringstream saved;
+    profiler.save(saved);
+    Profiler::AccumulatorTable table;
+    profiler.export_accumulators(table);
+    CHECK(table.size() == 2);
+}
+
+// A profiler can be returned and moved, as in auto profiler = Profiler::Profiler() before C++17
+static void test_move()
+{
+    auto profiler = Profiler::Profiler();
+    profiler.start("a");
+    profiler.stop("a");
+    Profiler::Profiler moved(std::move(profiler));
+    moved.start("b");
+    moved.stop("b");
+    Profiler::AccumulatorTable table;
+    moved.export_accumulators(table);
+    CHECK(table.size() == 2);
+    profiler = std::move(moved);
+    CHECK(profiler.get_ncalls(profiler.handle("a")) == 1);
+}
+
+// Profilers with timers created in a different order, keyed timers included, share the nodes of the table
+static void test_export_by_path()
+{
+    Profiler::Profiler a, b;
+    a.start("x");
+    a.start("k", 2);
+    a.stop("k", 2);
+    a.start("y");
+    a.stop("y");
+    a.stop("x");
+    b.start("x");
+    b.start("y");
+    b.stop("y");
+    b.start("k", 2);
+    b.stop("k", 2);
+    b.start("k", 1);
+    b.stop("k", 1);
+    b.stop("x");
+    Profiler::AccumulatorTable table;
+    a.export_accumulators(table);
+    b.export_accumulators(table);
+    CHECK(table.size() == 5);
+    const auto k2 = table.node("x/k/k[2]", 2);
+    const auto k1 = table.node("x/k/k[1]", 2);
+    CHECK(table.size() == 5);
+    table.fit(table.profiles[0]);
+    CHECK(table.profiles[0].ncalls[k2] == 1 && table.profiles[1].ncalls[k2] == 1);
+    CHECK(table.profiles[0].ncalls[k1] == 0 && table.profiles[1].ncalls[k1] == 1);
+    CHECK(table.histogram.empty());
+}
+
+// Two workers merged under the spawning timer take twice its time: no negative unaccounted time
+static void test_merged_children_exceed_parent()
+{
+    std::ostringstream os;
+    Profiler::Profiler profiler(os);
+    profiler.start("phase");
+    const auto ctx = profiler.capture_span();
+    std::vector<Profiler::Profiler> workers(2);
+    std::vector<std::thread> threads;
+    for (auto &w: workers)
+        threads.emplace_back([&w, &ctx]() {
+            w.adopt(ctx);
+            w.start("task");
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            w.stop("task");
+        });
+    for (auto &t: threads) t.join();
+    profiler.stop("phase");
+    for (const auto &w: workers) profiler.merge(w);
+    const auto report = profiler.get_profile_string();
+    CHECK(report.find("<children exceed parent>") != std::string::npos);
+    bool negative = false;
+    for (auto pos = report.find(" -"); pos != std::string::npos; pos = report.find(" -", pos + 1))
+        negative = negative || std::isdigit(static_cast<unsigned char>(report[pos + 2]));
+    CHECK(!negative);
+    CHECK(report.find("<unaccounted>") == std::string::npos);
+}
+
+// The snapshot and the handle getters give the same values in the same units
+static void test_snapshot_matches_handles()
+{
+    std::ostringstream os;
+    Profiler::Profiler profiler(os);
+    profiler.start("outer");
+    for (int i = 0; i < 3; i++)
+    {
+        profiler.start("inner");
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        profiler.stop("inner");
+    }
+    profiler.stop("outer");
+    Profiler::Snapshot snap;
+    profiler.snapshot(snap);
+    const auto paths = profiler.node_paths();
+    CHECK(snap.size() == paths.size());
+    for (size_t i = 0; i < snap.size(); i++)
+    {
+        Profiler::TimerHandle h;
+        h.id = snap.path_id[i];
+        CHECK(snap.ncalls[i] == profiler.get_ncalls(h));
+        CHECK(snap.cpu_time[i] == profiler.get_cpu_time(h));
+        CHECK(snap.wall_time[i] == profiler.get_wall_time(h));
+        CHECK(snap.cpu_last[i] == profiler.get_cpu_time_last(h));
+        CHECK(snap.wall_last[i] == profiler.get_wall_time_last(h));
+    }
+    const auto inner = profiler.handle("inner");
+    CHECK(paths[inner.id] == "outer/inner");
+    CHECK(profiler.get_wall_time_last(inner) == profiler.get_wall_time_last("inner"));
+    // ms, as get_wall_time_last(name)
+    CHECK(snap.wall_time[inner.id] >= 6.0 && snap.wall_time[inner.id] < 1000.0);
+
+    // Handles past the timers of the profiler, e.g. of another one
+    Profiler::TimerHandle stray;
+    stray.id = uint32_t(paths.size() + 1000);
+    CHECK(!profiler.owns(stray) && profiler.owns(inner));
+    CHECK(profiler.get_ncalls(stray) == 0 && profiler.get_wall_time(stray) == 0.0);
+    CHECK(profiler.get_cpu_time_last(stray) == -1.0 && profiler.get_wall_time_last(stray) == 0.0);
+}
+
+// The log and the warnings name timers as passed to start and stop, the notes are for the report
+static void test_log_uses_names()
+{
+    std::ostringstream os;
+    Profiler::Profiler profiler(os);
+    profiler.start("solve", "Linear solver");
+    profiler.start("kpt", 3, "k-point");
+    profiler.stop("other");
+    profiler.stop("kpt", 3);
+    profiler.stop("solve");
+    const auto log = os.str();
+    CHECK(log.find("Timer start: solve") != std::string::npos);
+    CHECK(log.find("Timer start: kpt[3]") != std::string::npos);
+    CHECK(log.find("Timer stop:  solve") != std::string::npos);
+    CHECK(log.find("current active timer is 'kpt[3]'") != std::string::npos);
+    CHECK(log.find("Linear solver") == std::string::npos);
+    CHECK(profiler.get_profile_string().find("Linear solver") != std::string::npos);
+}
+
+// A flight recorder file that cannot be written is reported, not logged as written, and takes no slot
+static void test_unwritable_flight_recorder()
+{
+    std::ostringstream os;
+    Profiler::Profiler profiler(os);
+    profiler.enable_flight_recorder(64, "/nonexistent-directory/flight", 2);
+    profiler.set_latency_threshold("slow", 0.0);
+    for (int i = 0; i < 4; i++)
+    {
+        profiler.start("slow");
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        profiler.stop("slow");
+    }
+    const auto log = os.str();
+    CHECK(log.find("Flight recorder written") == std::string::npos);
+    CHECK(log.find("Cannot write the flight recorder to /nonexistent-directory/flight_r0_t") != std::string::npos);
+    CHECK(log.find("giving up") != std::string::npos);
+}
+
+int main()
+{
+    test_missing_key_lookup();
+    test_move();
+    test_export_by_path();
+    test_merged_children_exceed_parent();
+    test_snapshot_matches_handles();
+    test_log_uses_names();
+    test_unwritable_flight_recorder();
+    if (nfailed == 0) std::cout << "All checks passed" << std::endl;
+    return nfailed == 0 ? 0 : 1;
+}
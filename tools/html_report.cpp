@@ -0,0 +1,62 @@
+// Standalone HTML report of profiles saved with Profiler::save, e.g. one per rank.
+//
+//   $CXX -O2 -I. tools/html_report.cpp -o html_report.exe
+//   ./html_report.exe [--title T] report.html profiler_myid_0.txt profiler_myid_1.txt ...
+//
+// Profiles are aligned by call path. Each profile is labelled with its metadata "rank"
+// (see Profiler::set_rank), or with its file name.
+#include "profiler_html.h"
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+int main(int argc, char *argv[])
+{
+    std::string title = "Profile";
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--title" && i + 1 < argc)
+            title = argv[++i];
+        else
+            args.push_back(arg);
+    }
+    if (args.size() < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " [--title T] report.html profile1 profile2 ..." << std::endl;
+        return 1;
+    }
+
+    Profiler::AccumulatorTable table;
+    std::vector<std::string> labels;
+    for (size_t i = 1; i < args.size(); i++)
+    {
+        std::ifstream ifs(args[i]);
+        Profiler::SavedProfile profile;
+        size_t error_line = 0;
+        if (!ifs || !Profiler::load_profile(ifs, profile, &error_line))
+        {
+            std::cerr << "Error: cannot read profile " << args[i];
+            if (ifs) std::cerr << ", line " << error_line;
+            std::cerr << std::endl;
+            return 1;
+        }
+        table.add_profile(profile);
+        const auto it = profile.metadata.find("rank");
+        labels.push_back(it != profile.metadata.end() ? "rank " + it->second : args[i]);
+    }
+
+    std::ofstream ofs(args[0]);
+    if (!ofs)
+    {
+        std::cerr << "Error: cannot write " << args[0] << std::endl;
+        return 1;
+    }
+    Profiler::write_html_report(ofs, table, title, labels);
+    std::cout << "Wrote " << table.size() << " nodes of " << table.nprofiles() << " profiles to " << args[0]
+              << std::endl;
+    return 0;
+}
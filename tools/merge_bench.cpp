@@ -0,0 +1,101 @@
+// Benchmark of merging many thread profiles: tree-walk Profiler::merge against the structure-of-arrays
+// AccumulatorTable.
+//
+//   $CXX -O3 -march=native -I. tools/merge_bench.cpp -o merge_bench.exe
+//   ./merge_bench.exe [nprofiles] [ntimers]      default 64 profiles of 10000 timers
+//
+// Every profile has the same timers, 100 top-level timers with ntimers / 100 children each,
+// created in a different order so that the node IDs of the profiles differ.
+#include "profiler.h"
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// The CPU time costs a system call per start and stop, which would dominate building the profiles.
+// The call time histograms give the percentiles of the reduction.
+struct BenchPolicy : Profiler::DefaultPolicy
+{
+    static constexpr bool cpu_time = false;
+    static constexpr bool call_times = true;
+};
+
+using BenchProfiler = Profiler::BasicProfiler<BenchPolicy>;
+
+static double seconds_since(const std::chrono::steady_clock::time_point &t0)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+int main(int argc, char *argv[])
+{
+    const int nprofiles = argc > 1 ? std::stoi(argv[1]) : 64;
+    const int ntimers = argc > 2 ? std::stoi(argv[2]) : 10000;
+    const int ntop = 100, nchildren = std::max(1, ntimers / ntop);
+
+    std::vector<std::string> top_names, child_names;
+    for (int i = 0; i < ntop; i++) top_names.push_back("phase_" + std::to_string(i));
+    for (int j = 0; j < nchildren; j++) child_names.push_back("kernel_" + std::to_string(j));
+
+    std::cout << "Building " << nprofiles << " profiles of " << ntop * (nchildren + 1) << " timers" << std::endl;
+    std::vector<std::unique_ptr<BenchProfiler>> profiles;
+    for (int p = 0; p < nprofiles; p++)
+    {
+        profiles.emplace_back(new BenchProfiler());
+        auto &prof = *profiles.back();
+        for (int k = 0; k < ntop; k++)
+        {
+            const auto &top = top_names[(k + p) % ntop];
+            prof.start(top);
+            for (int j = 0; j < nchildren; j++)
+            {
+                prof.start(child_names[(j + p) % nchildren]);
+                prof.stop(child_names[(j + p) % nchildren]);
+            }
+            prof.stop(top);
+        }
+    }
+
+    std::cout << Profiler::banner('-', 60) << "\n";
+    auto t0 = std::chrono::steady_clock::now();
+    BenchProfiler merged;
+    for (const auto &prof: profiles) merged.merge(*prof);
+    const auto t_tree = seconds_since(t0);
+    std::cout << std::left << std::setw(40) << "Tree-walk merge (s)" << t_tree << "\n";
+
+    t0 = std::chrono::steady_clock::now();
+    Profiler::AccumulatorTable table;
+    for (const auto &prof: profiles) prof->export_accumulators(table);
+    const auto t_export = seconds_since(t0);
+    std::cout << std::setw(40) << "Export to accumulator table (s)" << t_export << "\n";
+
+    t0 = std::chrono::steady_clock::now();
+    const auto reduction = table.reduce();
+    const auto t_reduce = seconds_since(t0);
+    std::cout << std::setw(40) << "Table reduction with percentiles (s)" << t_reduce << "\n";
+
+    // Sums only, as done by the tree-walk merge
+    t0 = std::chrono::steady_clock::now();
+    std::vector<uint64_t> ncalls(table.size(), 0);
+    std::vector<double> wall(table.size(), 0.0);
+    for (const auto &c: table.profiles)
+    {
+        for (size_t i = 0; i < c.ncalls.size(); i++) ncalls[i] += c.ncalls[i];
+        for (size_t i = 0; i < c.wall_time.size(); i++) wall[i] += c.wall_time[i];
+    }
+    const auto t_sum = seconds_since(t0);
+    std::cout << std::setw(40) << "Table sums (s)" << t_sum << "\n";
+    std::cout << Profiler::banner('-', 60) << "\n";
+
+    // Both merges must agree
+    uint64_t total_tree = 0, total_table = 0;
+    Profiler::AccumulatorTable check;
+    merged.export_accumulators(check);
+    for (const auto n: check.profiles[0].ncalls) total_tree += n;
+    for (const auto n: reduction.ncalls) total_table += n;
+    std::cout << "calls: tree-walk " << total_tree << ", table " << total_table
+              << (total_tree == total_table ? "" : "  MISMATCH") << "\n";
+    return total_tree == total_table ? 0 : 1;
+}
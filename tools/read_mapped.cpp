@@ -0,0 +1,224 @@
+// Reader of the profiles mapped to a file by Profiler::enable_persistent, while the process runs or after
+// it died, including by SIGKILL.
+//
+//   $CXX -O2 -I. tools/read_mapped.cpp -o read_mapped.exe
+//   ./read_mapped.exe profile.map [--save profile.txt]
+//
+// --save writes the profile in the format of Profiler::save, for tools/scaling.cpp or tools/html_report.cpp.
+// Times only cover the completed calls. Timers still running at the end are marked "running", and a hot line
+// left in the middle of an update by a killed process is marked "torn". A line of a live process kept busy
+// through all the retries, e.g. a stopped process, is marked "busy".
+#include "profiler.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using Profiler::MappedHeader;
+using Profiler::MappedNode;
+
+//! Consistent copy of a hot line and its tree node
+struct Node
+{
+    std::string name;
+    uint32_t parent = 0;
+    bool keyed = false;
+    int64_t key = 0;
+    uint64_t ncalls = 0;
+    double wall_s = 0.0, cpu_s = 0.0;
+    //! start of the running call in s since the creation of the file, negative if not running
+    double running_since = -1.0;
+    bool torn = false;
+    bool busy = false;
+    std::vector<uint32_t> children;
+};
+
+template <typename T>
+static T field(const char *line, const int32_t offset)
+{
+    T v = 0;
+    if (offset >= 0) std::memcpy(&v, line + offset, sizeof(T));
+    return v;
+}
+
+// Copy the line between two equal even sequence numbers. While the writer is alive, spin, then yield and
+// sleep between the retries for up to about a second; an update left unfinished by a dead process is torn.
+static void read_line(const MappedHeader &h, const char *line, const bool live, Node &node)
+{
+    const auto *seq = reinterpret_cast<const volatile uint64_t *>(line + h.off_seq);
+    for (int attempt = 0; attempt < 2000; attempt++)
+    {
+        if (attempt >= 100)
+        {
+            if (!live || kill(h.pid, 0) != 0) break;
+            if (attempt < 1000)
+                sched_yield();
+            else
+                usleep(1000);
+        }
+        const uint64_t before = *seq;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const auto start = field<int64_t>(line, h.off_start);
+        node.ncalls = field<uint64_t>(line, h.off_ncalls);
+        node.wall_s = double(field<int64_t>(line, h.off_accu)) * h.ns_per_tick * 1e-9;
+        node.cpu_s = field<double>(line, h.off_cpu_accu);
+        node.running_since =
+            start != 0 ? (double(start) * h.ns_per_tick + double(h.clock_offset_ns - h.created_ns)) * 1e-9 : -1.0;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if ((before & 1) == 0 && *seq == before) return;
+    }
+    // The process may have died during the retries
+    node.busy = live && kill(h.pid, 0) == 0;
+    node.torn = !node.busy;
+}
+
+static std::string label(const Node &n)
+{
+    return n.keyed ? n.name + "[" + std::to_string(n.key) + "]" : n.name;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string fname, save;
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--save" && i + 1 < argc)
+            save = argv[++i];
+        else
+            fname = arg;
+    }
+    if (fname.empty())
+    {
+        std::cerr << "Usage: " << argv[0] << " profile.map [--save profile.txt]" << std::endl;
+        return 1;
+    }
+
+    const int fd = ::open(fname.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(MappedHeader))
+    {
+        std::cerr << "Error: cannot read " << fname << std::endl;
+        return 1;
+    }
+    const auto size = size_t(st.st_size);
+    void *p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+    {
+        std::cerr << "Error: cannot map " << fname << std::endl;
+        return 1;
+    }
+    const auto *base = static_cast<const char *>(p);
+    const auto &h = *reinterpret_cast<const MappedHeader *>(base);
+    if (std::memcmp(h.magic, Profiler::mapped_magic, sizeof(Profiler::mapped_magic)) != 0 || h.version != 1 ||
+        h.node_size != sizeof(MappedNode) || h.off_seq < 0)
+    {
+        std::cerr << "Error: " << fname << " is not a mapped profile of version 1" << std::endl;
+        return 1;
+    }
+
+    // Segments past the end of the file at the time of the mapping are left out
+    const auto nsegments = std::min<size_t>(h.nsegments.load(std::memory_order_acquire),
+                                            (size - h.header_size) / h.segment_size);
+    const bool closed = h.closed.load(std::memory_order_acquire) != 0;
+    const bool alive = !closed && kill(h.pid, 0) == 0;
+    std::vector<Node> nodes(nsegments * h.chunk_nodes);
+    std::vector<bool> published(nodes.size(), false);
+    for (size_t id = 0; id < nodes.size(); id++)
+    {
+        const auto *segment = base + h.header_size + (id / h.chunk_nodes) * size_t(h.segment_size);
+        const auto &record = reinterpret_cast<const MappedNode *>(segment + size_t(h.chunk_nodes) * h.line_size)
+                                 [id % h.chunk_nodes];
+        if (record.published.load(std::memory_order_acquire) != 1) continue;
+        published[id] = true;
+        auto &n = nodes[id];
+        n.name.assign(record.name, strnlen(record.name, sizeof(record.name)));
+        if (record.name_length > n.name.size()) n.name += "...";
+        n.parent = record.parent;
+        n.keyed = record.keyed != 0;
+        n.key = record.key;
+        read_line(h, segment + (id % h.chunk_nodes) * size_t(h.line_size), alive, n);
+    }
+    std::vector<uint32_t> roots;
+    for (size_t id = 0; id < nodes.size(); id++)
+    {
+        if (!published[id]) continue;
+        if (nodes[id].parent == 0 || nodes[id].parent > nodes.size() || !published[nodes[id].parent - 1])
+            roots.push_back(uint32_t(id));
+        else
+            nodes[nodes[id].parent - 1].children.push_back(uint32_t(id));
+    }
+    // Keys first in order, then the children in creation order, as in Profiler::save
+    for (auto &n: nodes)
+        std::stable_sort(n.children.begin(), n.children.end(), [&nodes](const uint32_t a, const uint32_t b) {
+            if (nodes[a].keyed != nodes[b].keyed) return nodes[a].keyed;
+            return nodes[a].keyed && nodes[a].key < nodes[b].key;
+        });
+
+    std::cout << "Process " << h.pid << ", "
+              << (closed ? "profiler destroyed normally" : alive ? "still running" : "killed or crashed") << ", "
+              << std::count(published.begin(), published.end(), true) << " timers\n";
+
+    std::ofstream ofs;
+    if (!save.empty())
+    {
+        ofs.open(save);
+        if (!ofs)
+        {
+            std::cerr << "Error: cannot write " << save << std::endl;
+            return 1;
+        }
+        ofs << std::setprecision(9) << Profiler::saved_profile_header << "\n";
+        ofs << "# pid\t" << h.pid << "\n";
+        ofs << "# end\t" << (closed ? "normal" : alive ? "running" : "killed") << "\n";
+    }
+
+    std::cout << std::left << Profiler::banner('-', 100) << "\n";
+    std::cout << std::setw(49) << "Entry" << " " << std::setw(12) << "#calls" << " " << std::setw(12) << "CPU time (s)"
+              << " " << std::setw(13) << "Wall time (s)" << " " << "State\n";
+    std::cout << Profiler::banner('-', 100) << "\n";
+    struct Frame
+    {
+        uint32_t id;
+        int depth;
+        std::string path;
+    };
+    std::vector<Frame> stack;
+    for (auto it = roots.rbegin(); it != roots.rend(); ++it) stack.push_back({*it, 0, label(nodes[*it])});
+    while (!stack.empty())
+    {
+        const auto f = stack.back();
+        stack.pop_back();
+        const auto &n = nodes[f.id];
+        std::ostringstream state;
+        if (n.torn) state << "torn ";
+        if (n.busy) state << "busy ";
+        if (n.running_since >= 0.0) state << "running since " << std::fixed << std::setprecision(3) << n.running_since << " s";
+        std::ostringstream cpu, wall;
+        cpu << std::fixed << std::setprecision(4) << n.cpu_s;
+        wall << std::fixed << std::setprecision(4) << n.wall_s;
+        std::cout << std::setw(49) << (std::string(f.depth, ' ') + label(n)) << " " << std::setw(12) << n.ncalls << " "
+                  << std::setw(12) << (h.off_cpu_accu >= 0 ? cpu.str() : "-") << " " << std::setw(13) << wall.str() << " "
+                  << state.str() << "\n";
+        if (ofs.is_open())
+            ofs << f.depth << "\t" << Profiler::sanitize_field(f.path) << "\t" << n.ncalls << "\t" << n.cpu_s << "\t"
+                << n.wall_s << "\t" << Profiler::sanitize_field(state.str()) << "\n";
+        for (auto c = n.children.rbegin(); c != n.children.rend(); ++c)
+            stack.push_back({*c, f.depth + 1, f.path + "/" + label(nodes[*c])});
+    }
+    std::cout << Profiler::banner('-', 100) << std::endl;
+    munmap(p, size);
+    return 0;
+}
@@ -0,0 +1,215 @@
+// Strong/weak scaling report from profiles saved with Profiler::save at several thread or rank counts.
+//
+//   $CXX -I. tools/scaling.cpp -o scaling.exe
+//   ./scaling.exe [--weak] [--top N] 1=prof_1.txt 2=prof_2.txt 4=prof_4.txt ...
+//
+// Each argument is "parallelism=file". Without "parallelism=", the parallelism is read from the
+// metadata "parallelism", "threads" or "ranks" of the profile (see Profiler::set_metadata).
+// Timers are aligned by call path. The smallest parallelism is the baseline.
+#include "profiler.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+struct Run
+{
+    double parallelism;
+    std::map<std::string, double> wall_time;
+};
+
+struct Row
+{
+    std::string path;
+    double t_base;
+    double t_last;
+    double speedup;
+    double efficiency;
+    double serial_fraction;
+    //! time at the largest parallelism above the ideal scaling of the baseline
+    double lost;
+};
+
+// Parse all of s as a number, false if it is not one
+static bool parse_number(const std::string &s, double &v)
+{
+    try
+    {
+        size_t end = 0;
+        v = std::stod(s, &end);
+        return end == s.size();
+    }
+    catch (const std::exception &)
+    {
+        return false;
+    }
+}
+
+static bool parse_run(const std::string &arg, Run &run)
+{
+    std::string fname = arg;
+    run.parallelism = 0.0;
+    const auto eq = arg.find('=');
+    if (eq != std::string::npos)
+    {
+        if (!parse_number(arg.substr(0, eq), run.parallelism))
+        {
+            std::cerr << "Error: invalid parallelism in " << arg << std::endl;
+            return false;
+        }
+        fname = arg.substr(eq + 1);
+    }
+    std::ifstream ifs(fname);
+    Profiler::SavedProfile profile;
+    size_t error_line = 0;
+    if (!ifs || !Profiler::load_profile(ifs, profile, &error_line))
+    {
+        std::cerr << "Error: cannot read profile " << fname;
+        if (ifs) std::cerr << ", line " << error_line;
+        std::cerr << std::endl;
+        return false;
+    }
+    for (const char *key: {"parallelism", "threads", "ranks"})
+    {
+        if (run.parallelism > 0.0) break;
+        const auto it = profile.metadata.find(key);
+        if (it != profile.metadata.end() && !parse_number(it->second, run.parallelism))
+        {
+            std::cerr << "Error: invalid " << key << " \"" << it->second << "\" in " << fname << std::endl;
+            return false;
+        }
+    }
+    if (run.parallelism <= 0.0)
+    {
+        std::cerr << "Error: no parallelism given for " << fname << std::endl;
+        return false;
+    }
+    for (const auto &e: profile.entries)
+        run.wall_time[e.path] += e.wall_time;
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    bool weak = false;
+    size_t ntop = 20;
+    std::vector<Run> runs;
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--weak")
+            weak = true;
+        else if (arg == "--top" && i + 1 < argc)
+        {
+            double n = 0.0;
+            if (!parse_number(argv[++i], n) || n < 0.0)
+            {
+                std::cerr << "Error: invalid --top " << argv[i] << std::endl;
+                return 1;
+            }
+            ntop = size_t(n);
+        }
+        else
+        {
+            Run run;
+            if (!parse_run(arg, run)) return 1;
+            runs.push_back(run);
+        }
+    }
+    if (runs.size() < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " [--weak] [--top N] p1=profile1 p2=profile2 ..." << std::endl;
+        return 1;
+    }
+    std::sort(runs.begin(), runs.end(), [](const Run &a, const Run &b) { return a.parallelism < b.parallelism; });
+    const auto &base = runs.front();
+    const auto &last = runs.back();
+    if (last.parallelism <= base.parallelism)
+    {
+        std::cerr << "Error: the profiles must have different parallelism" << std::endl;
+        return 1;
+    }
+    const double p = last.parallelism / base.parallelism;
+
+    std::vector<Row> rows;
+    for (const auto &kv: base.wall_time)
+    {
+        Row r;
+        r.path = kv.first;
+        r.t_base = kv.second;
+        const auto it = last.wall_time.find(kv.first);
+        r.t_last = it == last.wall_time.end() ? 0.0 : it->second;
+        if (r.t_last <= 0.0 || r.t_base <= 0.0) continue;
+        if (weak)
+        {
+            // Scaled speedup, serial fraction from Gustafson's law
+            r.efficiency = r.t_base / r.t_last;
+            r.speedup = p * r.efficiency;
+            r.serial_fraction = (p - r.speedup) / (p - 1.0);
+            r.lost = r.t_last - r.t_base;
+        }
+        else
+        {
+            // Karp-Flatt metric
+            r.speedup = r.t_base / r.t_last;
+            r.efficiency = r.speedup / p;
+            r.serial_fraction = (1.0 / r.speedup - 1.0 / p) / (1.0 - 1.0 / p);
+            r.lost = r.t_last - r.t_base / p;
+        }
+        rows.push_back(r);
+    }
+    std::sort(rows.begin(), rows.end(), [](const Row &a, const Row &b) { return a.lost > b.lost; });
+
+    std::cout << std::left;
+    std::cout << (weak ? "Weak" : "Strong") << " scaling from " << base.parallelism << " to " << last.parallelism
+              << ", timers ranked by time lost against ideal scaling at " << last.parallelism << "\n";
+    std::cout << Profiler::banner('-', 120) << "\n";
+    std::cout << std::setw(43) << "Entry" << " " << std::setw(12) << "T base (s)" << " " << std::setw(12) << "T last (s)"
+              << " " << std::setw(10) << "Speedup" << " " << std::setw(10) << "Efficiency" << " " << std::setw(12)
+              << "Serial frac" << " " << std::setw(12) << "Lost (s)" << "\n";
+    std::cout << Profiler::banner('-', 120) << "\n";
+    std::cout << std::fixed;
+    for (size_t i = 0; i < rows.size() && i < ntop; i++)
+    {
+        const auto &r = rows[i];
+        std::cout << std::setw(43) << r.path << " " << std::setprecision(4) << std::setw(12) << r.t_base << " "
+                  << std::setw(12) << r.t_last << " " << std::setprecision(2) << std::setw(10) << r.speedup << " "
+                  << std::setw(10) << r.efficiency << " " << std::setprecision(3) << std::setw(12) << r.serial_fraction
+                  << " " << std::setprecision(4) << std::setw(12) << r.lost << "\n";
+    }
+    std::cout << Profiler::banner('-', 120) << "\n\n";
+
+    // Efficiency at every parallelism for the same timers
+    std::cout << "Parallel efficiency\n";
+    std::cout << Profiler::banner('-', 120) << "\n";
+    std::cout << std::setw(43) << "Entry";
+    for (const auto &run: runs)
+    {
+        std::ostringstream ss;
+        ss << "p=" << std::defaultfloat << run.parallelism;
+        std::cout << " " << std::setw(9) << ss.str();
+    }
+    std::cout << "\n" << Profiler::banner('-', 120) << "\n";
+    for (size_t i = 0; i < rows.size() && i < ntop; i++)
+    {
+        std::cout << std::setw(43) << rows[i].path;
+        for (const auto &run: runs)
+        {
+            const auto it = run.wall_time.find(rows[i].path);
+            std::cout << " " << std::setw(9);
+            if (it == run.wall_time.end() || it->second <= 0.0)
+            {
+                std::cout << "-";
+                continue;
+            }
+            const auto ratio = rows[i].t_base / it->second;
+            std::cout << std::setprecision(2) << (weak ? ratio : ratio * base.parallelism / run.parallelism);
+        }
+        std::cout << "\n";
+    }
+    std::cout << Profiler::banner('-', 120) << "\n";
+    return 0;
+}
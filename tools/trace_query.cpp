@@ -0,0 +1,558 @@
+// Query tool over binary traces written by Profiler::write_trace.
+//
+//   $CXX -O2 -I. tools/trace_query.cpp -o trace_query.exe
+//   ./trace_query.exe TRACE info
+//   ./trace_query.exe TRACE total NAME T0 T1          total time of NAME within [T0, T1]
+//   ./trace_query.exe TRACE slow NAME SECONDS [T0 T1] calls of NAME slower than SECONDS
+//   ./trace_query.exe TRACE at TID T                  timers running on thread TID at time T
+//   ./trace_query.exe TRACE extract T0 T1 OUT.json    Chrome trace of the calls overlapping [T0, T1]
+//
+// Times are in seconds from the first event of the trace.
+// The first query builds TRACE.idx, a time-bucketed index per thread and per timer, with one pass
+// over the events. Later queries only read the buckets of the queried time range from the mapped files.
+#include "profiler.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using Profiler::TraceRecord;
+
+//! Read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+    const char *data = nullptr;
+    size_t size = 0;
+
+    bool open(const std::string &fname)
+    {
+        const int fd = ::open(fname.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0)
+        {
+            ::close(fd);
+            return false;
+        }
+        size = size_t(st.st_size);
+        void *p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) return false;
+        data = static_cast<const char *>(p);
+        return true;
+    }
+
+    void close()
+    {
+        if (data) munmap(const_cast<char *>(data), size);
+        data = nullptr;
+        size = 0;
+    }
+
+    ~MappedFile() { close(); }
+};
+
+struct Trace
+{
+    int32_t pid = 0;
+    std::vector<std::string> names;
+    const TraceRecord *events = nullptr;
+    uint64_t nevents = 0;
+
+    int64_t end(const uint64_t i) const { return events[i].ts_ns + events[i].dur_ns; }
+};
+
+static bool parse_trace(const MappedFile &file, Trace &trace)
+{
+    const char *p = file.data;
+    const char *end = file.data + file.size;
+    if (file.size < sizeof(Profiler::trace_magic) + 12 ||
+        std::memcmp(p, Profiler::trace_magic, sizeof(Profiler::trace_magic)) != 0)
+        return false;
+    p += sizeof(Profiler::trace_magic);
+    uint32_t version, nnames;
+    std::memcpy(&version, p, 4); p += 4;
+    std::memcpy(&trace.pid, p, 4); p += 4;
+    std::memcpy(&nnames, p, 4); p += 4;
+    if (version != 1) return false;
+    for (uint32_t i = 0; i < nnames; i++)
+    {
+        uint32_t len;
+        if (end - p < 4) return false;
+        std::memcpy(&len, p, 4); p += 4;
+        if (len > size_t(end - p)) return false;
+        trace.names.emplace_back(p, len);
+        p += len;
+    }
+    if (end - p < 8) return false;
+    std::memcpy(&trace.nevents, p, 8); p += 8;
+    // Compared by division, a corrupt count must not overflow the product
+    if (trace.nevents > uint64_t(end - p) / sizeof(TraceRecord)) return false;
+    trace.events = reinterpret_cast<const TraceRecord *>(p);
+    return true;
+}
+
+//! Statistics of the calls of one timer starting in one bucket
+struct BucketStats
+{
+    int64_t sum_dur;
+    int64_t max_dur;
+    int64_t max_end;
+    uint64_t ncalls;
+};
+
+struct IndexHeader
+{
+    char magic[8];
+    uint64_t trace_size;
+    uint64_t nevents;
+    int64_t t_min;
+    int64_t t_max;
+    int64_t bucket_ns;
+    uint64_t nbuckets;
+    uint64_t nnames;
+    uint64_t nthreads;
+    // byte offsets of the arrays in the index file
+    uint64_t off_tids;          // nthreads uint64, thread IDs
+    uint64_t off_thread_order;  // nevents uint64, events sorted by thread and start
+    uint64_t off_thread_bucket; // nthreads * (nbuckets + 1) uint64, positions in thread_order
+    uint64_t off_open_bucket;   // nthreads * nbuckets + 1 uint64, positions in open
+    uint64_t off_open;          // events still running at the start of each thread bucket
+    uint64_t off_timer_order;   // nevents uint64, events sorted by name and start
+    uint64_t off_timer_bucket;  // nnames * (nbuckets + 1) uint64, positions in timer_order
+    uint64_t off_timer_stats;   // nnames * nbuckets BucketStats
+    uint64_t size;
+};
+
+static const char index_magic[8] = {'S', 'P', 'T', 'I', 'D', 'X', '0', '1'};
+
+//! Index mapped from the index file
+struct Index
+{
+    const IndexHeader *h = nullptr;
+    const uint64_t *tids, *thread_order, *thread_bucket, *open_bucket, *open, *timer_order, *timer_bucket;
+    const BucketStats *timer_stats;
+
+    void attach(const char *base)
+    {
+        h = reinterpret_cast<const IndexHeader *>(base);
+        tids = reinterpret_cast<const uint64_t *>(base + h->off_tids);
+        thread_order = reinterpret_cast<const uint64_t *>(base + h->off_thread_order);
+        thread_bucket = reinterpret_cast<const uint64_t *>(base + h->off_thread_bucket);
+        open_bucket = reinterpret_cast<const uint64_t *>(base + h->off_open_bucket);
+        open = reinterpret_cast<const uint64_t *>(base + h->off_open);
+        timer_order = reinterpret_cast<const uint64_t *>(base + h->off_timer_order);
+        timer_bucket = reinterpret_cast<const uint64_t *>(base + h->off_timer_bucket);
+        timer_stats = reinterpret_cast<const BucketStats *>(base + h->off_timer_stats);
+    }
+
+    uint64_t bucket_of(const int64_t ts) const
+    {
+        if (ts <= h->t_min) return 0;
+        return std::min<uint64_t>(uint64_t((ts - h->t_min) / h->bucket_ns), h->nbuckets - 1);
+    }
+
+    int64_t bucket_start(const uint64_t b) const { return h->t_min + int64_t(b) * h->bucket_ns; }
+
+    // Events of name starting in bucket b are timer_order[lo, hi)
+    void timer_range(const uint64_t name, const uint64_t b, uint64_t &lo, uint64_t &hi) const
+    {
+        lo = timer_bucket[name * (h->nbuckets + 1) + b];
+        hi = timer_bucket[name * (h->nbuckets + 1) + b + 1];
+    }
+
+    void thread_range(const uint64_t slot, const uint64_t b, uint64_t &lo, uint64_t &hi) const
+    {
+        lo = thread_bucket[slot * (h->nbuckets + 1) + b];
+        hi = thread_bucket[slot * (h->nbuckets + 1) + b + 1];
+    }
+
+    int64_t max_dur(const uint64_t name) const
+    {
+        int64_t m = 0;
+        for (uint64_t b = 0; b < h->nbuckets; b++) m = std::max(m, timer_stats[name * h->nbuckets + b].max_dur);
+        return m;
+    }
+};
+
+template <typename T>
+static void write_array(std::ofstream &ofs, const std::vector<T> &v)
+{
+    ofs.write(reinterpret_cast<const char *>(v.data()), std::streamsize(v.size() * sizeof(T)));
+}
+
+//! Build the index with one pass over the events and write it to fname
+static bool build_index(const Trace &trace, const size_t trace_size, const std::string &fname)
+{
+    const uint64_t n = trace.nevents;
+    IndexHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, index_magic, sizeof(index_magic));
+    h.trace_size = trace_size;
+    h.nevents = n;
+    h.nnames = trace.names.size();
+    h.t_min = n ? trace.events[0].ts_ns : 0;
+    h.t_max = h.t_min;
+    std::vector<uint64_t> tids;
+    for (uint64_t i = 0; i < n; i++)
+    {
+        h.t_min = std::min(h.t_min, trace.events[i].ts_ns);
+        h.t_max = std::max(h.t_max, trace.end(i));
+        tids.push_back(trace.events[i].tid);
+    }
+    std::sort(tids.begin(), tids.end());
+    tids.erase(std::unique(tids.begin(), tids.end()), tids.end());
+    h.nthreads = tids.size();
+    // About 256 events per bucket, with the per-timer statistics kept below 2^22 entries
+    h.nbuckets = std::max<uint64_t>(1, std::min<uint64_t>(n / 256, 65536));
+    while (h.nbuckets > 1 && h.nbuckets * std::max<uint64_t>(h.nnames, 1) > (uint64_t(1) << 22)) h.nbuckets /= 2;
+    h.bucket_ns = std::max<int64_t>(1, (h.t_max - h.t_min) / int64_t(h.nbuckets) + 1);
+
+    auto slot_of = [&](const uint64_t tid) {
+        return uint64_t(std::lower_bound(tids.begin(), tids.end(), tid) - tids.begin());
+    };
+    auto bucket_of = [&](const int64_t ts) {
+        return std::min<uint64_t>(uint64_t((ts - h.t_min) / h.bucket_ns), h.nbuckets - 1);
+    };
+    // Outer calls first at equal start
+    auto earlier = [&](const uint64_t a, const uint64_t b) {
+        const auto &ea = trace.events[a], &eb = trace.events[b];
+        return ea.ts_ns != eb.ts_ns ? ea.ts_ns < eb.ts_ns : ea.dur_ns > eb.dur_ns;
+    };
+
+    std::vector<uint64_t> thread_order(n), timer_order(n);
+    std::iota(thread_order.begin(), thread_order.end(), 0);
+    std::iota(timer_order.begin(), timer_order.end(), 0);
+    std::sort(thread_order.begin(), thread_order.end(), [&](const uint64_t a, const uint64_t b) {
+        const auto ta = trace.events[a].tid, tb = trace.events[b].tid;
+        return ta != tb ? ta < tb : earlier(a, b);
+    });
+    std::sort(timer_order.begin(), timer_order.end(), [&](const uint64_t a, const uint64_t b) {
+        const auto na = trace.events[a].name, nb = trace.events[b].name;
+        return na != nb ? na < nb : earlier(a, b);
+    });
+
+    std::vector<uint64_t> thread_bucket(h.nthreads * (h.nbuckets + 1), 0);
+    std::vector<uint64_t> open_bucket(h.nthreads * h.nbuckets + 1, 0);
+    std::vector<uint64_t> open;
+    uint64_t pos = 0;
+    for (uint64_t slot = 0; slot < h.nthreads; slot++)
+    {
+        std::vector<uint64_t> active;
+        for (uint64_t b = 0; b < h.nbuckets; b++)
+        {
+            const auto bstart = h.t_min + int64_t(b) * h.bucket_ns;
+            active.erase(std::remove_if(active.begin(), active.end(),
+                                        [&](const uint64_t i) { return trace.end(i) <= bstart; }),
+                         active.end());
+            open_bucket[slot * h.nbuckets + b] = open.size();
+            open.insert(open.end(), active.begin(), active.end());
+            thread_bucket[slot * (h.nbuckets + 1) + b] = pos;
+            while (pos < n && slot_of(trace.events[thread_order[pos]].tid) == slot &&
+                   bucket_of(trace.events[thread_order[pos]].ts_ns) == b)
+            {
+                active.push_back(thread_order[pos]);
+                pos++;
+            }
+        }
+        thread_bucket[slot * (h.nbuckets + 1) + h.nbuckets] = pos;
+    }
+    open_bucket[h.nthreads * h.nbuckets] = open.size();
+
+    std::vector<uint64_t> timer_bucket(h.nnames * (h.nbuckets + 1), 0);
+    std::vector<BucketStats> timer_stats(h.nnames * h.nbuckets, BucketStats{0, 0, 0, 0});
+    pos = 0;
+    for (uint64_t name = 0; name < h.nnames; name++)
+    {
+        for (uint64_t b = 0; b < h.nbuckets; b++)
+        {
+            timer_bucket[name * (h.nbuckets + 1) + b] = pos;
+            auto &st = timer_stats[name * h.nbuckets + b];
+            while (pos < n && trace.events[timer_order[pos]].name == name &&
+                   bucket_of(trace.events[timer_order[pos]].ts_ns) == b)
+            {
+                const auto i = timer_order[pos];
+                st.sum_dur += trace.events[i].dur_ns;
+                st.max_dur = std::max(st.max_dur, trace.events[i].dur_ns);
+                st.max_end = std::max(st.max_end, trace.end(i));
+                st.ncalls++;
+                pos++;
+            }
+        }
+        timer_bucket[name * (h.nbuckets + 1) + h.nbuckets] = pos;
+    }
+
+    h.off_tids = sizeof(IndexHeader);
+    h.off_thread_order = h.off_tids + tids.size() * 8;
+    h.off_thread_bucket = h.off_thread_order + n * 8;
+    h.off_open_bucket = h.off_thread_bucket + thread_bucket.size() * 8;
+    h.off_open = h.off_open_bucket + open_bucket.size() * 8;
+    h.off_timer_order = h.off_open + open.size() * 8;
+    h.off_timer_bucket = h.off_timer_order + n * 8;
+    h.off_timer_stats = h.off_timer_bucket + timer_bucket.size() * 8;
+    h.size = h.off_timer_stats + timer_stats.size() * sizeof(BucketStats);
+
+    std::ofstream ofs(fname, std::ios::binary);
+    if (!ofs) return false;
+    ofs.write(reinterpret_cast<const char *>(&h), sizeof(h));
+    write_array(ofs, tids);
+    write_array(ofs, thread_order);
+    write_array(ofs, thread_bucket);
+    write_array(ofs, open_bucket);
+    write_array(ofs, open);
+    write_array(ofs, timer_order);
+    write_array(ofs, timer_bucket);
+    write_array(ofs, timer_stats);
+    return bool(ofs);
+}
+
+static int64_t to_ns(const Index &idx, const std::string &seconds)
+{
+    return idx.h->t_min + int64_t(std::stod(seconds) * 1e9);
+}
+
+static double to_s(const Index &idx, const int64_t ns)
+{
+    return (ns - idx.h->t_min) * 1e-9;
+}
+
+static int name_index(const Trace &trace, const std::string &name)
+{
+    for (size_t i = 0; i < trace.names.size(); i++)
+        if (trace.names[i] == name) return int(i);
+    std::cerr << "Error: no timer named " << name << " in the trace" << std::endl;
+    return -1;
+}
+
+static void query_info(const Trace &trace, const Index &idx)
+{
+    std::cout << std::left << "pid " << trace.pid << ", " << idx.h->nevents << " calls on " << idx.h->nthreads
+              << " threads over " << to_s(idx, idx.h->t_max) << " s, " << idx.h->nbuckets << " buckets of "
+              << idx.h->bucket_ns * 1e-9 << " s\n";
+    std::cout << "threads:";
+    for (uint64_t slot = 0; slot < idx.h->nthreads; slot++) std::cout << " " << idx.tids[slot];
+    std::cout << "\n" << Profiler::banner('-', 80) << "\n";
+    std::cout << std::setw(49) << "Entry" << " " << std::setw(12) << "#calls" << " " << std::setw(18) << "Wall time (s)"
+              << "\n" << Profiler::banner('-', 80) << "\n";
+    for (uint64_t name = 0; name < idx.h->nnames; name++)
+    {
+        uint64_t ncalls = 0;
+        int64_t total = 0;
+        for (uint64_t b = 0; b < idx.h->nbuckets; b++)
+        {
+            ncalls += idx.timer_stats[name * idx.h->nbuckets + b].ncalls;
+            total += idx.timer_stats[name * idx.h->nbuckets + b].sum_dur;
+        }
+        std::cout << std::setw(49) << trace.names[name] << " " << std::setw(12) << ncalls << " " << total * 1e-9 << "\n";
+    }
+    std::cout << Profiler::banner('-', 80) << "\n";
+}
+
+static void query_total(const Trace &trace, const Index &idx, const int name, const int64_t t0, const int64_t t1)
+{
+    int64_t total = 0;
+    uint64_t ncalls = 0, nscanned = 0;
+    // Calls starting up to the longest call of the timer before t0 may still run in the window
+    const auto b_first = idx.bucket_of(t0 - idx.max_dur(name));
+    const auto b_last = idx.bucket_of(t1);
+    for (auto b = b_first; b <= b_last; b++)
+    {
+        const auto &st = idx.timer_stats[name * idx.h->nbuckets + b];
+        if (st.ncalls == 0 || st.max_end <= t0) continue;
+        const auto bstart = idx.bucket_start(b);
+        if (bstart >= t0 && bstart + idx.h->bucket_ns <= t1 && st.max_end <= t1)
+        {
+            // Every call of the bucket is inside the window
+            total += st.sum_dur;
+            ncalls += st.ncalls;
+            continue;
+        }
+        uint64_t lo, hi;
+        idx.timer_range(name, b, lo, hi);
+        for (auto k = lo; k < hi; k++)
+        {
+            const auto &e = trace.events[idx.timer_order[k]];
+            nscanned++;
+            const auto overlap = std::min(e.ts_ns + e.dur_ns, t1) - std::max(e.ts_ns, t0);
+            if (overlap <= 0) continue;
+            total += overlap;
+            ncalls++;
+        }
+    }
+    std::cout << trace.names[name] << ": " << total * 1e-9 << " s in " << ncalls << " calls between "
+              << to_s(idx, t0) << " and " << to_s(idx, t1) << " s (" << nscanned << " calls scanned)\n";
+}
+
+static void query_slow(const Trace &trace, const Index &idx, const int name, const int64_t min_dur,
+                       const int64_t t0, const int64_t t1)
+{
+    std::vector<uint64_t> found;
+    for (auto b = idx.bucket_of(t0); b <= idx.bucket_of(t1); b++)
+    {
+        if (idx.timer_stats[name * idx.h->nbuckets + b].max_dur < min_dur) continue;
+        uint64_t lo, hi;
+        idx.timer_range(name, b, lo, hi);
+        for (auto k = lo; k < hi; k++)
+        {
+            const auto &e = trace.events[idx.timer_order[k]];
+            if (e.dur_ns >= min_dur && e.ts_ns >= t0 && e.ts_ns <= t1) found.push_back(idx.timer_order[k]);
+        }
+    }
+    std::cout << std::left << found.size() << " calls of " << trace.names[name] << " slower than " << min_dur * 1e-9
+              << " s\n" << std::setw(18) << "Start (s)" << " " << std::setw(18) << "Wall time (s)" << " " << "Thread\n";
+    for (const auto i: found)
+    {
+        const auto &e = trace.events[i];
+        std::cout << std::setw(18) << to_s(idx, e.ts_ns) << " " << std::setw(18) << e.dur_ns * 1e-9 << " " << e.tid << "\n";
+    }
+}
+
+static void query_at(const Trace &trace, const Index &idx, const uint64_t tid, const int64_t t)
+{
+    const auto it = std::lower_bound(idx.tids, idx.tids + idx.h->nthreads, tid);
+    if (it == idx.tids + idx.h->nthreads || *it != tid)
+    {
+        std::cerr << "Error: no thread " << tid << " in the trace" << std::endl;
+        return;
+    }
+    const uint64_t slot = uint64_t(it - idx.tids);
+    const auto b = idx.bucket_of(t);
+    std::vector<uint64_t> running;
+    for (auto k = idx.open_bucket[slot * idx.h->nbuckets + b]; k < idx.open_bucket[slot * idx.h->nbuckets + b + 1]; k++)
+        if (trace.end(idx.open[k]) > t) running.push_back(idx.open[k]);
+    uint64_t lo, hi;
+    idx.thread_range(slot, b, lo, hi);
+    for (auto k = lo; k < hi && trace.events[idx.thread_order[k]].ts_ns <= t; k++)
+        if (trace.end(idx.thread_order[k]) > t) running.push_back(idx.thread_order[k]);
+    std::cout << "thread " << tid << " at " << to_s(idx, t) << " s:\n";
+    for (size_t level = 0; level < running.size(); level++)
+    {
+        const auto &e = trace.events[running[level]];
+        std::cout << std::string(level + 1, ' ') << trace.names[e.name] << " [" << to_s(idx, e.ts_ns) << ", "
+                  << to_s(idx, e.ts_ns + e.dur_ns) << "] s\n";
+    }
+}
+
+static void query_extract(const Trace &trace, const Index &idx, const int64_t t0, const int64_t t1,
+                          const std::string &fname)
+{
+    std::ofstream ofs(fname);
+    ofs << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+    bool first = true;
+    uint64_t nwritten = 0;
+    auto write = [&](const TraceRecord &e) {
+        ofs << (first ? "\n" : ",\n");
+        first = false;
+        ofs << "{\"name\":\"" << Profiler::json_escape(trace.names[e.name]) << "\",\"ph\":\"X\",\"ts\":" << e.ts_ns * 1e-3
+            << ",\"dur\":" << e.dur_ns * 1e-3 << ",\"pid\":" << trace.pid << ",\"tid\":" << e.tid << "}";
+        nwritten++;
+    };
+    const auto b0 = idx.bucket_of(t0), b1 = idx.bucket_of(t1);
+    for (uint64_t slot = 0; slot < idx.h->nthreads; slot++)
+    {
+        for (auto k = idx.open_bucket[slot * idx.h->nbuckets + b0]; k < idx.open_bucket[slot * idx.h->nbuckets + b0 + 1]; k++)
+            if (trace.end(idx.open[k]) > t0) write(trace.events[idx.open[k]]);
+        for (auto b = b0; b <= b1; b++)
+        {
+            uint64_t lo, hi;
+            idx.thread_range(slot, b, lo, hi);
+            for (auto k = lo; k < hi; k++)
+            {
+                const auto &e = trace.events[idx.thread_order[k]];
+                if (e.ts_ns <= t1 && e.ts_ns + e.dur_ns > t0) write(e);
+            }
+        }
+    }
+    ofs << "\n]}\n";
+    std::cout << nwritten << " calls written to " << fname << "\n";
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " TRACE info|total|slow|at|extract ..." << std::endl;
+        return 1;
+    }
+    const std::string fname = argv[1], cmd = argv[2];
+    MappedFile trace_file;
+    Trace trace;
+    if (!trace_file.open(fname) || !parse_trace(trace_file, trace))
+    {
+        std::cerr << "Error: cannot read trace " << fname << std::endl;
+        return 1;
+    }
+    // Records follow variable-length names, copy them if they are not aligned
+    std::vector<TraceRecord> aligned;
+    if (reinterpret_cast<uintptr_t>(trace.events) % alignof(TraceRecord) != 0)
+    {
+        aligned.resize(trace.nevents);
+        std::memcpy(aligned.data(), trace.events, trace.nevents * sizeof(TraceRecord));
+        trace.events = aligned.data();
+    }
+
+    const auto idx_fname = fname + ".idx";
+    MappedFile idx_file;
+    Index idx;
+    bool valid = idx_file.open(idx_fname);
+    if (valid)
+    {
+        idx.attach(idx_file.data);
+        valid = idx_file.size >= sizeof(IndexHeader) && std::memcmp(idx.h->magic, index_magic, 8) == 0 &&
+                idx.h->trace_size == trace_file.size && idx.h->nevents == trace.nevents && idx.h->size == idx_file.size;
+    }
+    if (!valid)
+    {
+        std::cerr << "Building index " << idx_fname << std::endl;
+        idx_file.close();
+        if (!build_index(trace, trace_file.size, idx_fname) || !idx_file.open(idx_fname))
+        {
+            std::cerr << "Error: cannot write index " << idx_fname << std::endl;
+            return 1;
+        }
+        idx.attach(idx_file.data);
+    }
+    if (trace.nevents == 0)
+    {
+        std::cout << "empty trace\n";
+        return 0;
+    }
+
+    std::cout << std::setprecision(9);
+    if (cmd == "info")
+        query_info(trace, idx);
+    else if (cmd == "total" && argc == 6)
+    {
+        const int name = name_index(trace, argv[3]);
+        if (name < 0) return 1;
+        query_total(trace, idx, name, to_ns(idx, argv[4]), to_ns(idx, argv[5]));
+    }
+    else if (cmd == "slow" && (argc == 5 || argc == 7))
+    {
+        const int name = name_index(trace, argv[3]);
+        if (name < 0) return 1;
+        const auto t0 = argc == 7 ? to_ns(idx, argv[5]) : idx.h->t_min;
+        const auto t1 = argc == 7 ? to_ns(idx, argv[6]) : idx.h->t_max;
+        query_slow(trace, idx, name, int64_t(std::stod(argv[4]) * 1e9), t0, t1);
+    }
+    else if (cmd == "at" && argc == 5)
+        query_at(trace, idx, std::stoull(argv[3]), to_ns(idx, argv[4]));
+    else if (cmd == "extract" && argc == 6)
+        query_extract(trace, idx, to_ns(idx, argv[3]), to_ns(idx, argv[4]), argv[5]);
+    else
+    {
+        std::cerr << "Error: unknown command or wrong arguments, see the header of trace_query.cpp" << std::endl;
+        return 1;
+    }
+    return 0;
+}